@@ -27,13 +27,16 @@ struct DynamicShadowedDirLight {
 
 @binding(3) @group(0) var<storage> dynamicShadowedDirLightStore : array<DynamicShadowedDirLight>;
 
+// Maps each drawn instance to its slot within objStore
+@binding(4) @group(0) var<storage> drawList : array<u32>;
+
 
 struct VertexIn {
     @location(0) position: vec3<f32>,
     @location(1) uvX : f32,
     @location(2) normal : vec3<f32>,
     @location(3) uvY : f32,
-    @builtin(instance_index) instance: u32, // Represents which instance within objStore to pull data from
+    @builtin(instance_index) instance: u32, // Represents which entry of drawList to pull data from
 }
 
 // Collects translation from a mat4x4 
@@ -52,10 +55,10 @@ struct ColorPassVertexOut {
 fn vtxMain(in : VertexIn) -> ColorPassVertexOut {
   var out : ColorPassVertexOut;
 
-  var worldPos = objStore[in.instance].transform * vec4<f32>(in.position,1);
+  var worldPos = objStore[drawList[in.instance]].transform * vec4<f32>(in.position,1);
 
   out.position = camera.projMat * camera.viewMat * worldPos;
-  out.color = objStore[in.instance].color;
+  out.color = objStore[drawList[in.instance]].color;
 
   return out;
 }
@@ -15,16 +15,19 @@ struct ObjData {
 
 @binding(1) @group(0) var<storage> objStore : array<ObjData>; 
 
+// Maps each drawn instance to its slot within objStore
+@binding(4) @group(0) var<storage> drawList : array<u32>;
+
 
 struct VertexIn {
     @location(0) position: vec3<f32>,
     @location(2) normal : vec3<f32>,
-    @builtin(instance_index) instance: u32, // Represents which instance within objStore to pull data from
+    @builtin(instance_index) instance: u32, // Represents which entry of drawList to pull data from
 }
 
 // Depth pass pipeline
 @vertex
 fn vtxMain(in : VertexIn) -> @builtin(position) vec4<f32> {
-  var worldPos = objStore[in.instance].transform * vec4<f32>(in.position,1);
+  var worldPos = objStore[drawList[in.instance]].transform * vec4<f32>(in.position,1);
   return camera.projMat * camera.viewMat * worldPos;
 }
\ No newline at end of file
@@ -9,7 +9,7 @@ struct MeshAsset
     std::vector<Vertex> vertices;
     std::vector<u32> indices;
 
-    AABB aabb;
+    MeshBounds bounds;
 };
 
 struct TextureAsset
@@ -4,6 +4,10 @@
 #include <fastgltf/types.hpp>
 #include <fastgltf/tools.hpp>
 
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
 template <>
 struct fastgltf::ElementTraits<glm::vec3> : fastgltf::ElementTraitsBase<glm::vec3, AccessorType::Vec3, f32> {};
 
@@ -13,6 +17,56 @@ struct fastgltf::ElementTraits<glm::vec2> : fastgltf::ElementTraitsBase<glm::vec
 std::unordered_map<std::string, MeshID> meshIDs;
 std::unordered_map<std::string, TextureID> texIDs;
 
+// Gets the box around the vertices and the smallest sphere around them
+// centered on it
+MeshBounds ComputeMeshBounds(Vertex *vertices, u32 vertCount)
+{
+    MeshBounds bounds{};
+    if (vertCount == 0)
+    {
+        return bounds;
+    }
+
+#if defined(__SSE2__) || defined(_M_X64)
+    // The position is the first 16 bytes of a vertex along with uvX,
+    // which is loaded too and ignored
+    __m128 lo = _mm_loadu_ps(&vertices[0].position.x);
+    __m128 hi = lo;
+    for (u32 i = 1; i < vertCount; i++)
+    {
+        __m128 position = _mm_loadu_ps(&vertices[i].position.x);
+        lo = _mm_min_ps(lo, position);
+        hi = _mm_max_ps(hi, position);
+    }
+
+    f32 loValues[4];
+    f32 hiValues[4];
+    _mm_storeu_ps(loValues, lo);
+    _mm_storeu_ps(hiValues, hi);
+    bounds.aabb.min = {loValues[0], loValues[1], loValues[2]};
+    bounds.aabb.max = {hiValues[0], hiValues[1], hiValues[2]};
+#else
+    bounds.aabb.min = vertices[0].position;
+    bounds.aabb.max = vertices[0].position;
+    for (u32 i = 1; i < vertCount; i++)
+    {
+        bounds.aabb.min = glm::min(bounds.aabb.min, vertices[i].position);
+        bounds.aabb.max = glm::max(bounds.aabb.max, vertices[i].position);
+    }
+#endif
+
+    glm::vec3 center = (bounds.aabb.min + bounds.aabb.max) * 0.5f;
+    f32 radiusSquared = 0.0f;
+    for (u32 i = 0; i < vertCount; i++)
+    {
+        glm::vec3 offset = vertices[i].position - center;
+        radiusSquared = std::max(radiusSquared, glm::dot(offset, offset));
+    }
+    bounds.sphere = {center, sqrtf(radiusSquared)};
+
+    return bounds;
+}
+
 PLATFORM_LOAD_MESH_ASSET(LoadMeshAsset)
 {
     if (meshIDs.contains(name))
@@ -78,11 +132,14 @@ PLATFORM_LOAD_MESH_ASSET(LoadMeshAsset)
         });
     }
 
+    asset.bounds = ComputeMeshBounds(asset.vertices.data(), asset.vertices.size());
+
     RenderUploadMeshInfo info{};
     info.vertData = asset.vertices.data();
     info.vertSize = asset.vertices.size();
     info.idxData = asset.indices.data();
     info.idxSize = asset.indices.size();
+    info.bounds = asset.bounds;
 
     MeshID id = UploadMesh(info);
     meshIDs[name] = id;
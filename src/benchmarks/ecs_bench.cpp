@@ -0,0 +1,219 @@
+// Microbenchmarks of the ECS hot paths, built as the ecs-bench target:
+//   cmake --build build --config Release --target ecs-bench
+// Each benchmark prints the best time per operation over several runs,
+// so it can be compared before and after a change to ecs.h/ecs.cpp.
+
+#include "game_platform.h"
+#include "math/skl_math_consts.h"
+
+#include "job_system.cpp"
+#include "ecs.cpp"
+
+#include <chrono>
+#include <cstdio>
+
+#define BENCH_RUNS 20
+#define LOOKUP_ENTITIES 20000
+#define SCAN_ENTITIES 100000
+#define FILTER_ENTITIES 1000000
+
+// Stand-ins for the game's components, of similar sizes
+struct BenchMesh
+{
+    s32 mesh;
+    s32 texture;
+    glm::vec3 color;
+    bool hidden;
+};
+
+struct BenchVelocity
+{
+    glm::vec3 value;
+};
+
+struct BenchPlane
+{
+    f32 width;
+    f32 length;
+};
+
+struct BenchHidden {};
+struct BenchStatic {};
+
+// The game binds component IDs in RegisterComponents, which also loads
+// the scene description. The benchmarks only need the IDs.
+template<typename T>
+local void BenchRegister(Scene &scene, const char *name, ComponentStorage storage = ARCHETYPE)
+{
+    if (cachedComponentId<T> == INVALID_COMPONENT)
+    {
+        cachedComponentId<T> = MakeComponentId(name);
+    }
+    scene.AddComponentType(sizeof(T), storage);
+}
+
+local void BenchRegisterAll(Scene &scene)
+{
+    BenchRegister<Transform3D>(scene, "Transform3D");
+    BenchRegister<BenchMesh>(scene, "BenchMesh");
+    BenchRegister<BenchVelocity>(scene, "BenchVelocity");
+    BenchRegister<BenchPlane>(scene, "BenchPlane", SPARSE_SET);
+    BenchRegister<BenchHidden>(scene, "BenchHidden", TAG);
+    BenchRegister<BenchStatic>(scene, "BenchStatic", TAG);
+}
+
+// Runs the function BENCH_RUNS times and returns the best time of a
+// run in nanoseconds per operation.
+template<typename Func>
+local f64 BestNsPerOp(u64 opCount, Func func)
+{
+    f64 best = 1e30;
+    for (u32 run = 0; run < BENCH_RUNS; run++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        func();
+        auto end = std::chrono::steady_clock::now();
+        f64 ns = std::chrono::duration<f64, std::nano>(end - start).count() / (f64)opCount;
+        best = std::min(best, ns);
+    }
+    return best;
+}
+
+// Scene::Get<Transform3D> on entities spread over several archetypes,
+// in creation order.
+local void BenchGet()
+{
+    Scene scene;
+    BenchRegisterAll(scene);
+
+    std::vector<EntityID> ents;
+    for (u32 i = 0; i < LOOKUP_ENTITIES; i++)
+    {
+        EntityID ent = scene.NewEntity();
+        scene.Assign<Transform3D>(ent)->position.x = 1.0f;
+        if (i % 2)
+        {
+            scene.Assign<BenchMesh>(ent);
+        }
+        if (i % 3 == 0)
+        {
+            scene.Assign<BenchPlane>(ent);
+        }
+        ents.push_back(ent);
+    }
+
+    f32 sum = 0.0f;
+    f64 ns = BestNsPerOp(ents.size(), [&]
+    {
+        for (EntityID ent : ents)
+        {
+            sum += scene.Get<Transform3D>(ent)->position.x;
+        }
+    });
+    printf("Get<Transform3D>              %8.2f ns/call     (%u entities, %g)\n", ns, LOOKUP_ENTITIES, sum);
+}
+
+// A two component SceneView walked with the iterator and Get, with
+// Each, and with ParallelEach.
+local void BenchScan()
+{
+    Scene scene;
+    BenchRegisterAll(scene);
+
+    for (u32 i = 0; i < SCAN_ENTITIES; i++)
+    {
+        EntityID ent = scene.NewEntity();
+        scene.Assign<Transform3D>(ent);
+        scene.Assign<BenchVelocity>(ent)->value = glm::vec3(1.0f, 0.0f, 0.0f);
+        if (i % 2)
+        {
+            scene.Assign<BenchMesh>(ent);
+        }
+        if (i % 5 == 0)
+        {
+            scene.Assign<BenchStatic>(ent);
+        }
+    }
+
+    f64 iteratorNs = BestNsPerOp(SCAN_ENTITIES, [&]
+    {
+        for (EntityID ent : SceneView<Transform3D, BenchVelocity>(scene))
+        {
+            scene.Get<Transform3D>(ent)->position += scene.Get<BenchVelocity>(ent)->value;
+        }
+    });
+
+    f64 eachNs = BestNsPerOp(SCAN_ENTITIES, [&]
+    {
+        SceneView<Transform3D, BenchVelocity>(scene).Each([](EntityID ent, Transform3D &transform, BenchVelocity &velocity)
+        {
+            transform.position += velocity.value;
+        });
+    });
+
+    f64 parallelNs = BestNsPerOp(SCAN_ENTITIES, [&]
+    {
+        SceneView<Transform3D, BenchVelocity>(scene).ParallelEach([](u32 index, EntityID ent, Transform3D &transform, BenchVelocity &velocity)
+        {
+            transform.position += velocity.value;
+        });
+    });
+
+    printf("SceneView iterator + Get      %8.2f ns/entity   (%u entities)\n", iteratorNs, SCAN_ENTITIES);
+    printf("SceneView::Each               %8.2f ns/entity\n", eachNs);
+    printf("SceneView::ParallelEach       %8.2f ns/entity   (%zu workers)\n", parallelNs, jobSystem->workers.size());
+}
+
+// A filtered view over a sparse set component, which walks the pool and
+// tests the component mask of every entity in it. Mask widths can be
+// compared by adding -DSKL_MAX_COMPONENTS=256, with or without -mavx2,
+// to CMAKE_CXX_FLAGS.
+local void BenchFilter()
+{
+    Scene scene;
+    BenchRegisterAll(scene);
+
+    for (u32 i = 0; i < FILTER_ENTITIES; i++)
+    {
+        EntityID ent = scene.NewEntity();
+        scene.Assign<Transform3D>(ent);
+        if (i % 2)
+        {
+            scene.Assign<BenchPlane>(ent);
+        }
+        if (i % 4 == 0)
+        {
+            scene.Assign<BenchHidden>(ent);
+        }
+        if (i % 3 == 0)
+        {
+            scene.Assign<BenchStatic>(ent);
+        }
+        if (i % 5 == 0)
+        {
+            scene.Assign<BenchMesh>(ent);
+        }
+    }
+
+    QueryFilter filter = QueryFilter().Without<BenchHidden>().AnyOf<BenchStatic, BenchMesh>();
+    u32 count = 0;
+    f64 ns = BestNsPerOp(FILTER_ENTITIES / 2, [&]
+    {
+        count = SceneView<BenchPlane>(scene, filter).Count();
+    });
+    printf("Filtered SceneView::Count     %8.2f ns/entity   (%u of %u matched, %zu bit masks)\n",
+           ns, count, FILTER_ENTITIES / 2, sizeof(ComponentMask) * 8);
+}
+
+int main(int argc, char **argv)
+{
+    jobSystem = new JobSystem(DefaultWorkerCount());
+
+    BenchGet();
+    BenchScan();
+    BenchFilter();
+
+    delete jobSystem;
+    jobSystem = nullptr;
+    return 0;
+}
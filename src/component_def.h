@@ -2,6 +2,8 @@
 #define COMPONENT_DEF_H
 
 #define COMP(name) struct name
+#define SPARSE_COMP(name) struct name
+#define TAG_COMP(name) struct name
 #define FIELD(type, name, start) type name = start
 #define LOCAL_FIELD(type, name, start) type name = start
 #define LOCAL_DEF(def) def
@@ -9,6 +11,8 @@
 #include "components.h"
 
 #undef COMP
+#undef SPARSE_COMP
+#undef TAG_COMP
 #undef FIELD
 #undef LOCAL_FIELD
 #undef LOCAL_DEF
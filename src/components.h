@@ -18,13 +18,44 @@
 #include <Jolt/Physics/Character/CharacterVirtual.h>
 
 // Define the game's components here
+// Components declared with SPARSE_COMP are stored in sparse sets
+// rather than archetypes, which suits components that are added and
+// removed often.
+// Components declared with TAG_COMP have no fields, and only mark the
+// entity. They take up no memory besides their bit in its mask, so
+// they are cheap to add and remove every frame. Views filter on them
+// with QueryFilter rather than taking them as components.
+
+// Keeps the entity's mesh from being rendered.
+TAG_COMP(Hidden)
+{
+};
+
+
+// Makes the entity's Transform3D relative to the world transform of
+// the parent entity. The depth counts the entity's ancestors, and is
+// kept up to date by the TransformSystem.
+COMP(Parent)
+{
+    LOCAL_FIELD(EntityID, entity, INVALID_ENTITY);
+    LOCAL_FIELD(u32, depth, 1);
+};
+
+// World space matrix of the entity, cached by the TransformSystem and
+// only recomputed when the entity's Transform3D or an ancestor's changes.
+COMP(WorldTransform)
+{
+    LOCAL_FIELD(glm::mat4, matrix, glm::mat4{1.0f});
+};
 
 COMP(MeshComponent)
 {
     FIELD(MeshID, mesh, -1);
     FIELD(TextureID, texture, -1);
     FIELD(glm::vec3, color, glm::vec3{1.0f});
-    LOCAL_FIELD(bool, dirty, true);
+    // The render instance drawing the mesh, kept by the RenderSystem
+    // while the entity has a world transform and is not hidden.
+    LOCAL_FIELD(InstanceID, instance, -1);
 };
 
 COMP(PlayerCharacter)
@@ -45,7 +76,7 @@ COMP(FlyingMovement)
     FIELD(float, turnSpeed, 0.1);
 };
 
-COMP(Plane)
+SPARSE_COMP(Plane)
 {
     FIELD(float, width, 1);
     FIELD(float, length, 1);
@@ -26,172 +26,1717 @@ inline bool IsEntityValid(EntityID id)
     return (id >> 32) != (u32) (-1);
 }
 
+inline EntityID RemapEntity(const std::vector<EntityID> &remap, EntityID id)
+{
+    // Entities keep their version, which tells stale IDs apart
+    u32 index = GetEntityIndex(id);
+    if (!IsEntityValid(id) || index >= remap.size() ||
+        GetEntityVersion(remap[index]) != GetEntityVersion(id))
+    {
+        return INVALID_ENTITY;
+    }
+    return remap[index];
+}
+
+/*
+ * VIRTUAL MEMORY
+ */
+
+// Memory is committed in steps of this many bytes, so that a growing
+// pool does not have to call into the OS for every entity.
+constexpr size_t COMMIT_GRANULARITY = 64 * 1024;
+
+local inline size_t AlignCommit(size_t size)
+{
+    return (size + COMMIT_GRANULARITY - 1) & ~(COMMIT_GRANULARITY - 1);
+}
+
+#if _WIN32
+
+#include <windows.h>
+
+local void *ReserveMemory(size_t size)
+{
+    return VirtualAlloc(nullptr, size, MEM_RESERVE, PAGE_NOACCESS);
+}
+
+local bool CommitMemory(void *address, size_t size)
+{
+    return VirtualAlloc(address, size, MEM_COMMIT, PAGE_READWRITE) != nullptr;
+}
+
+local void ReleaseMemory(void *address, size_t size)
+{
+    VirtualFree(address, 0, MEM_RELEASE);
+}
+
+#else
+
+#include <sys/mman.h>
+
+local void *ReserveMemory(size_t size)
+{
+    void *result = mmap(nullptr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return result == MAP_FAILED ? nullptr : result;
+}
+
+local bool CommitMemory(void *address, size_t size)
+{
+    return mprotect(address, size, PROT_READ | PROT_WRITE) == 0;
+}
+
+local void ReleaseMemory(void *address, size_t size)
+{
+    munmap(address, size);
+}
+
+#endif
+
+// Grows the committed front of a reserved range to cover at least the
+// given number of bytes, never going past the reserved size.
+local void CommitUpTo(u8 *base, size_t &committed, size_t size, size_t reserved)
+{
+    if (size <= committed)
+        return;
+
+    size_t target = std::min(AlignCommit(size), reserved);
+    if (!CommitMemory(base + committed, target - committed))
+    {
+        printf("Unable to commit memory for a sparse set component pool\n");
+        exit(1);
+    }
+    committed = target;
+}
+
 /*
  * COMPONENT POOL
  */
 
-ComponentPool::ComponentPool(size_t elementsize)
-{
-    // We'll allocate enough memory to hold MAX_ENTITIES, each with element size
-    elementSize = elementsize;
-    pData = new u8[elementSize * MAX_ENTITIES];
+#define INVALID_SLOT ((u32)(-1))
+
+ComponentPool::ComponentPool(size_t elementsize)
+{
+    // We'll reserve enough memory to hold MAX_ENTITIES, each with element size
+    elementSize = elementsize;
+    pData = (u8 *)ReserveMemory(AlignCommit(elementSize * MAX_ENTITIES));
+    dense = (EntityID *)ReserveMemory(AlignCommit(sizeof(EntityID) * MAX_ENTITIES));
+    sparse = (u32 *)ReserveMemory(AlignCommit(sizeof(u32) * MAX_ENTITIES));
+    ticks = (u32 *)ReserveMemory(AlignCommit(sizeof(u32) * MAX_ENTITIES));
+    if (!pData || !dense || !sparse || !ticks)
+    {
+        printf("Unable to reserve memory for a sparse set component pool\n");
+        exit(1);
+    }
+}
+
+ComponentPool::~ComponentPool()
+{
+    ReleaseMemory(pData, AlignCommit(elementSize * MAX_ENTITIES));
+    ReleaseMemory(dense, AlignCommit(sizeof(EntityID) * MAX_ENTITIES));
+    ReleaseMemory(sparse, AlignCommit(sizeof(u32) * MAX_ENTITIES));
+    ReleaseMemory(ticks, AlignCommit(sizeof(u32) * MAX_ENTITIES));
+}
+
+inline bool ComponentPool::Has(u32 index)
+{
+    return index < sparseCommitted / sizeof(u32) && sparse[index] != INVALID_SLOT;
+}
+
+inline void *ComponentPool::get(u32 index)
+{
+    // looking up the component through the entity's slot
+    return pData + sparse[index] * elementSize;
+}
+
+inline u32 *ComponentPool::GetTick(u32 index)
+{
+    return ticks + sparse[index];
+}
+
+void *ComponentPool::Add(EntityID id)
+{
+    u32 index = GetEntityIndex(id);
+    if (index >= MAX_ENTITIES)
+    {
+        printf("Entity index exceeds the capacity of a sparse set component pool\n");
+        exit(1);
+    }
+
+    // Newly committed parts of the sparse table start out as empty slots
+    size_t sparseOld = sparseCommitted;
+    CommitUpTo((u8 *)sparse, sparseCommitted, sizeof(u32) * (index + 1),
+               AlignCommit(sizeof(u32) * MAX_ENTITIES));
+    memset((u8 *)sparse + sparseOld, 0xFF, sparseCommitted - sparseOld);
+
+    CommitUpTo((u8 *)dense, denseCommitted, sizeof(EntityID) * (count + 1),
+               AlignCommit(sizeof(EntityID) * MAX_ENTITIES));
+    CommitUpTo(pData, dataCommitted, elementSize * (count + 1),
+               AlignCommit(elementSize * MAX_ENTITIES));
+    CommitUpTo((u8 *)ticks, ticksCommitted, sizeof(u32) * (count + 1),
+               AlignCommit(sizeof(u32) * MAX_ENTITIES));
+
+    sparse[index] = count;
+    dense[count] = id;
+    return pData + count++ * elementSize;
+}
+
+void ComponentPool::Remove(u32 index)
+{
+    u32 slot = sparse[index];
+    u32 last = --count;
+    if (slot != last)
+    {
+        EntityID moved = dense[last];
+        dense[slot] = moved;
+        sparse[GetEntityIndex(moved)] = slot;
+        memcpy(pData + slot * elementSize, pData + last * elementSize, elementSize);
+        ticks[slot] = ticks[last];
+    }
+    sparse[index] = INVALID_SLOT;
+}
+
+/*
+ * ARCHETYPE
+ */
+
+// Columns start on a 16 byte boundary so that every component is
+// suitably aligned.
+local inline u32 AlignColumn(u32 offset)
+{
+    return (offset + 15) & ~15u;
+}
+
+Archetype::Archetype(ComponentMask componentMask, std::vector<size_t> &componentSizes)
+{
+    mask = componentMask;
+    for (u32 i = 0; i < MAX_COMPONENTS; i++)
+    {
+        columns[i] = INVALID_ARCHETYPE;
+        addEdges[i] = INVALID_ARCHETYPE;
+        removeEdges[i] = INVALID_ARCHETYPE;
+    }
+
+    u32 rowSize = sizeof(EntityID);
+    for (u32 i = 0; i < componentSizes.size(); i++)
+    {
+        if (mask.test(i))
+        {
+            columns[i] = (u32)componentIds.size();
+            componentIds.push_back(i);
+            elementSizes.push_back((u32)componentSizes[i]);
+            rowSize += (u32)componentSizes[i] + sizeof(u32);
+        }
+    }
+
+    // Fit as many rows as possible into one chunk, leaving room for
+    // the padding between columns.
+    u32 padding = 16 * 2 * (u32)componentIds.size();
+    chunkCapacity = std::max((ARCHETYPE_CHUNK_SIZE - padding) / rowSize, 1u);
+
+    u32 offset = AlignColumn(chunkCapacity * sizeof(EntityID));
+    for (u32 size : elementSizes)
+    {
+        columnOffsets.push_back(offset);
+        offset = AlignColumn(offset + chunkCapacity * size);
+    }
+    for (u32 i = 0; i < componentIds.size(); i++)
+    {
+        tickOffsets.push_back(offset);
+        offset = AlignColumn(offset + chunkCapacity * sizeof(u32));
+    }
+    chunkBytes = std::max(offset, ARCHETYPE_CHUNK_SIZE);
+}
+
+Archetype::~Archetype()
+{
+    for (u8 *chunk : chunks)
+    {
+        delete[] chunk;
+    }
+}
+
+inline u32 Archetype::ChunkCount(u32 chunk)
+{
+    return std::min(count - chunk * chunkCapacity, chunkCapacity);
+}
+
+inline EntityID *Archetype::GetEntities(u32 chunk)
+{
+    return (EntityID *)chunks[chunk];
+}
+
+inline void *Archetype::GetColumn(u32 chunk, u32 componentId)
+{
+    return chunks[chunk] + columnOffsets[columns[componentId]];
+}
+
+inline void *Archetype::Get(u32 chunk, u32 slot, u32 componentId)
+{
+    u32 column = columns[componentId];
+    return chunks[chunk] + columnOffsets[column] + slot * elementSizes[column];
+}
+
+inline u32 *Archetype::GetTicks(u32 chunk, u32 componentId)
+{
+    return (u32 *)(chunks[chunk] + tickOffsets[columns[componentId]]);
+}
+
+/*
+ * COMMAND BUFFER
+ */
+
+EntityID CommandBuffer::NewEntity()
+{
+    return CreateEntityId(PENDING_ENTITY_BIT | pendingCount++, 0);
+}
+
+void CommandBuffer::DestroyEntity(EntityID id)
+{
+    commands.push_back({DESTROY_ENTITY, id, 0, 0});
+}
+
+bool CommandBuffer::IsEmpty()
+{
+    return commands.empty() && pendingCount == 0;
+}
+
+void CommandBuffer::Clear()
+{
+    commands.clear();
+    data.clear();
+    pendingCount = 0;
+}
+
+/*
+ * SCENE FUNCTIONALITY
+ */
+
+// Each component has its own memory pool, to have good memory
+// locality. An entity's ID is the index into its own component in the
+// component pool.
+Scene::~Scene()
+{
+    for (System *sys : systems)
+    {
+        delete sys;
+    }
+    for (Query *query : queries)
+    {
+        delete query;
+    }
+    for (ComponentPool *pool : componentPools)
+    {
+        delete pool;
+    }
+    for (Archetype *archetype : archetypes)
+    {
+        delete archetype;
+    }
+}
+
+void Scene::AddSystem(System *sys)
+{
+    systems.push_back(sys);
+}
+
+void Scene::InitSystems()
+{
+    for (System *sys : systems)
+    {
+        sys->OnStart(this);
+    }
+}
+
+// Whether two systems must not run at the same time, because one of
+// them writes components the other touches on some entity.
+local bool SystemsConflict(Scene &scene, System *a, System *b)
+{
+    if (a->accesses.empty() || b->accesses.empty())
+        return true;
+
+    for (SystemAccess &x : a->accesses)
+    {
+        for (SystemAccess &y : b->accesses)
+        {
+            bool overlap = (x.writes & (y.reads | y.writes)).any() || (y.writes & x.reads).any();
+            if (overlap && scene.AnyEntityMatches(x.with | y.with))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+void Scene::UpdateSystems(GameInput *input, f32 deltaTime)
+{
+    u32 count = (u32) systems.size();
+    if (!jobSystem)
+    {
+        for (System *sys: systems)
+        {
+            sys->OnUpdate(this, input, deltaTime);
+        }
+    }
+    else
+    {
+        // Each system waits for the earlier systems it conflicts with.
+        // Structural changes are held back until every system is done,
+        // so the entities matched here stay the same for the frame.
+        std::vector<std::vector<u32>> dependents(count);
+        std::vector<std::atomic<u32>> waitingOn(count);
+        for (u32 i = 0; i < count; i++)
+        {
+            for (u32 j = 0; j < i; j++)
+            {
+                if (SystemsConflict(*this, systems[j], systems[i]))
+                {
+                    dependents[j].push_back(i);
+                    waitingOn[i]++;
+                }
+            }
+        }
+
+        std::atomic<u32> finished{0};
+        std::mutex mainReadyMutex;
+        std::vector<u32> mainReady;
+
+        std::function<void(u32)> schedule;
+        auto runSystem = [&](u32 index)
+        {
+            systems[index]->OnUpdate(this, input, deltaTime);
+            for (u32 dependent : dependents[index])
+            {
+                if (waitingOn[dependent].fetch_sub(1) == 1)
+                {
+                    schedule(dependent);
+                }
+            }
+            finished++;
+        };
+        schedule = [&](u32 index)
+        {
+            if (systems[index]->runOnMainThread)
+            {
+                std::lock_guard<std::mutex> lock(mainReadyMutex);
+                mainReady.push_back(index);
+            }
+            else
+            {
+                jobSystem->Push([&runSystem, index] { runSystem(index); });
+            }
+        };
+
+        for (u32 i = 0; i < count; i++)
+        {
+            if (waitingOn[i] == 0)
+            {
+                schedule(i);
+            }
+        }
+
+        // The main thread runs the systems that need it, and otherwise
+        // helps with the queued ones.
+        while (finished < count)
+        {
+            u32 index = (u32)(-1);
+            {
+                std::lock_guard<std::mutex> lock(mainReadyMutex);
+                if (!mainReady.empty())
+                {
+                    index = mainReady.front();
+                    mainReady.erase(mainReady.begin());
+                }
+            }
+
+            if (index != (u32)(-1))
+            {
+                runSystem(index);
+            }
+            else if (!jobSystem->TryRunJob())
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // Sync point, apply the deferred changes in system order
+    for (System *sys : systems)
+    {
+        if (!sys->commands.IsEmpty())
+        {
+            Playback(sys->commands);
+        }
+    }
+
+    changeTick++;
+}
+
+void UpdateScenes(const std::vector<Scene *> &scenes, GameInput *input, f32 deltaTime)
+{
+    ParallelFor((u32)scenes.size(), 1, [&](u32 i)
+    {
+        scenes[i]->UpdateSystems(input, deltaTime);
+    });
+}
+
+bool Scene::AnyEntityMatches(ComponentMask mask)
+{
+    ComponentMask sparse = mask & sparseMask;
+    if (sparse.none())
+    {
+        Query *query = GetQuery({mask});
+        for (u32 index : query->archetypes)
+        {
+            Archetype *archetype = archetypes[index];
+            if (query->exact && archetype->count > 0)
+            {
+                return true;
+            }
+
+            // Tags are not part of the archetype mask
+            for (u32 row = 0; !query->exact && row < archetype->count; row++)
+            {
+                EntityID id = archetype->GetEntities(row / archetype->chunkCapacity)[row % archetype->chunkCapacity];
+                if (mask == (mask & entities[GetEntityIndex(id)].mask))
+                {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    // Walk the smallest pool, and test the mask of each entity in it
+    ComponentPool *pPool = nullptr;
+    for (u32 i = 0; i < componentPools.size(); i++)
+    {
+        ComponentPool *pool = componentPools[i];
+        if (sparse.test(i) && (!pPool || pool->count < pPool->count))
+        {
+            pPool = pool;
+        }
+    }
+
+    for (u32 i = 0; i < pPool->count; i++)
+    {
+        if (mask == (mask & entities[GetEntityIndex(pPool->dense[i])].mask))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Scene::AddComponentType(size_t size, ComponentStorage storage)
+{
+    if (storage == SPARSE_SET)
+    {
+        sparseMask.set(componentSizes.size());
+        looseMask.set(componentSizes.size());
+        componentPools.push_back(new ComponentPool(size));
+    }
+    else
+    {
+        componentPools.push_back(nullptr);
+    }
+
+    // An empty struct still has a size of one byte
+    if (storage == TAG)
+    {
+        tagMask.set(componentSizes.size());
+        looseMask.set(componentSizes.size());
+        size = 0;
+    }
+    componentSizes.push_back(size);
+    assignObservers.emplace_back();
+    removeObservers.emplace_back();
+}
+
+ComponentStorage Scene::GetStorage(u32 componentId)
+{
+    if (tagMask.test(componentId))
+    {
+        return TAG;
+    }
+    return componentPools[componentId] ? SPARSE_SET : ARCHETYPE;
+}
+
+// Whether the entities of an archetype with the given mask can match
+// the filter. Sparse set components and tags are not part of the
+// archetype mask, so terms on them are left to the per entity test.
+local bool ArchetypeMatches(Scene &scene, const QueryFilter &filter, ComponentMask mask)
+{
+    ComponentMask with = filter.with & ~scene.looseMask;
+    return (mask & with) == with && (mask & filter.without).none() &&
+            (filter.anyOf.none() || (mask & filter.anyOf).any() || (filter.anyOf & scene.looseMask).any());
+}
+
+u32 Scene::GetArchetype(ComponentMask mask)
+{
+    if (auto search = archetypeIndices.find(mask);
+            search != archetypeIndices.end())
+    {
+        return search->second;
+    }
+
+    u32 index = (u32) archetypes.size();
+    archetypes.push_back(new Archetype(mask, componentSizes));
+    archetypeIndices[mask] = index;
+
+    for (Query *query : queries)
+    {
+        if (ArchetypeMatches(*this, query->filter, mask))
+        {
+            query->archetypes.push_back(index);
+        }
+    }
+    return index;
+}
+
+Query *Scene::GetQuery(const QueryFilter &filter)
+{
+    // A registration can rehash the index under a lookup, so both take
+    // the lock. Archetypes are only created at sync points, so the
+    // returned query's archetype list is stable while systems run.
+    std::lock_guard<std::mutex> lock(queryMutex);
+    if (auto search = queryIndices.find(filter);
+            search != queryIndices.end())
+    {
+        return queries[search->second];
+    }
+
+    Query *query = new Query();
+    query->filter = filter;
+    query->exact = ((filter.with | filter.without | filter.anyOf) & looseMask).none();
+    for (u32 i = 0; i < archetypes.size(); i++)
+    {
+        if (ArchetypeMatches(*this, filter, archetypes[i]->mask))
+        {
+            query->archetypes.push_back(i);
+        }
+    }
+
+    queryIndices[filter] = (u32) queries.size();
+    queries.push_back(query);
+    return query;
+}
+
+// Appends a row for the given entity to the end of the given archetype.
+local void AddRow(Scene &scene, EntityID id, u32 archetypeIndex)
+{
+    Archetype *archetype = scene.archetypes[archetypeIndex];
+    u32 chunk = archetype->count / archetype->chunkCapacity;
+    u32 slot = archetype->count % archetype->chunkCapacity;
+    if (chunk == archetype->chunks.size())
+    {
+        archetype->chunks.push_back(new u8[archetype->chunkBytes]);
+    }
+    archetype->GetEntities(chunk)[slot] = id;
+    archetype->count++;
+
+    // Components in sparse sets and tags are unaffected by the move
+    Scene::EntityEntry &entry = scene.entities[GetEntityIndex(id)];
+    entry.archetype = archetypeIndex;
+    entry.chunk = chunk;
+    entry.slot = slot;
+    entry.mask = archetype->mask | (entry.mask & scene.looseMask);
+}
+
+// Removes the given row from an archetype by moving the archetype's
+// last row into its place.
+local void RemoveRow(Scene &scene, u32 archetypeIndex, u32 chunk, u32 slot)
+{
+    Archetype *archetype = scene.archetypes[archetypeIndex];
+    u32 last = archetype->count - 1;
+    u32 lastChunk = last / archetype->chunkCapacity;
+    u32 lastSlot = last % archetype->chunkCapacity;
+
+    if (lastChunk != chunk || lastSlot != slot)
+    {
+        EntityID moved = archetype->GetEntities(lastChunk)[lastSlot];
+        archetype->GetEntities(chunk)[slot] = moved;
+        for (u32 componentId : archetype->componentIds)
+        {
+            memcpy(archetype->Get(chunk, slot, componentId),
+                   archetype->Get(lastChunk, lastSlot, componentId),
+                   archetype->elementSizes[archetype->columns[componentId]]);
+            archetype->GetTicks(chunk, componentId)[slot] = archetype->GetTicks(lastChunk, componentId)[lastSlot];
+        }
+
+        Scene::EntityEntry &movedEntry = scene.entities[GetEntityIndex(moved)];
+        movedEntry.chunk = chunk;
+        movedEntry.slot = slot;
+    }
+    archetype->count--;
+
+    // Hand back trailing chunks as they empty, but keep the first one
+    // around since the archetype is likely to be refilled.
+    if (lastSlot == 0 && lastChunk > 0)
+    {
+        delete[] archetype->chunks.back();
+        archetype->chunks.pop_back();
+    }
+}
+
+void Scene::MoveEntity(EntityID id, u32 archetypeIndex)
+{
+    EntityEntry &entry = entities[GetEntityIndex(id)];
+    u32 oldArchetype = entry.archetype;
+    u32 oldChunk = entry.chunk;
+    u32 oldSlot = entry.slot;
+
+    AddRow(*this, id, archetypeIndex);
+
+    // Carry over the components both archetypes have in common
+    Archetype *src = archetypes[oldArchetype];
+    Archetype *dst = archetypes[archetypeIndex];
+    for (u32 componentId : dst->componentIds)
+    {
+        if (src->columns[componentId] != INVALID_ARCHETYPE)
+        {
+            memcpy(dst->Get(entry.chunk, entry.slot, componentId),
+                   src->Get(oldChunk, oldSlot, componentId),
+                   dst->elementSizes[dst->columns[componentId]]);
+            dst->GetTicks(entry.chunk, componentId)[entry.slot] = src->GetTicks(oldChunk, componentId)[oldSlot];
+        }
+    }
+
+    RemoveRow(*this, oldArchetype, oldChunk, oldSlot);
+}
+
+void Scene::MigrateComponent(u32 componentId, size_t size,
+                             const std::function<void(void *, void *)> &migrate)
+{
+    componentSizes[componentId] = size;
+
+    if (ComponentPool *oldPool = componentPools[componentId])
+    {
+        ComponentPool *pool = new ComponentPool(size);
+        for (u32 i = 0; i < oldPool->count; i++)
+        {
+            migrate(pool->Add(oldPool->dense[i]), oldPool->pData + i * oldPool->elementSize);
+            pool->ticks[i] = oldPool->ticks[i];
+        }
+        componentPools[componentId] = pool;
+        delete oldPool;
+        return;
+    }
+
+    // The archetypes keep their index, so queries and the entity table
+    // stay valid apart from the positions of the rows.
+    for (u32 index = 0; index < archetypes.size(); index++)
+    {
+        Archetype *old = archetypes[index];
+        if (!old->mask.test(componentId))
+            continue;
+
+        Archetype *archetype = new Archetype(old->mask, componentSizes);
+        memcpy(archetype->addEdges, old->addEdges, sizeof(archetype->addEdges));
+        memcpy(archetype->removeEdges, old->removeEdges, sizeof(archetype->removeEdges));
+        archetypes[index] = archetype;
+
+        for (u32 row = 0; row < old->count; row++)
+        {
+            u32 oldChunk = row / old->chunkCapacity;
+            u32 oldSlot = row % old->chunkCapacity;
+            EntityID id = old->GetEntities(oldChunk)[oldSlot];
+            AddRow(*this, id, index);
+
+            EntityEntry &entry = entities[GetEntityIndex(id)];
+            for (u32 column : archetype->componentIds)
+            {
+                void *dst = archetype->Get(entry.chunk, entry.slot, column);
+                void *src = old->Get(oldChunk, oldSlot, column);
+                if (column == componentId)
+                {
+                    migrate(dst, src);
+                }
+                else
+                {
+                    memcpy(dst, src, componentSizes[column]);
+                }
+                archetype->GetTicks(entry.chunk, column)[entry.slot] = old->GetTicks(oldChunk, column)[oldSlot];
+            }
+        }
+        delete old;
+    }
+}
+
+EntityID Scene::NewEntity()
+{
+    EntityID newID;
+    // std::vector::size runs in constant time.
+    if (!freeIndices.empty())
+    {
+        u32 newIndex = freeIndices.back();
+        freeIndices.pop_back();
+        // Takes in index and incremented EntityVersion at that index
+        newID = CreateEntityId(newIndex, GetEntityVersion(entities[newIndex].id));
+        entities[newIndex].id = newID;
+    }
+    else
+    {
+        newID = CreateEntityId((u32) (entities.size()), 0);
+        entities.push_back({newID, ComponentMask()});
+    }
+
+    // New entities start out in the archetype with no components
+    AddRow(*this, newID, GetArchetype(ComponentMask()));
+    return newID;
+}
+
+// Fills count elements of the given size with copies of the value, by
+// copying ever larger runs of what was already filled in.
+local void FillRepeated(u8 *dest, const u8 *value, size_t size, u32 count)
+{
+    if (count == 0)
+        return;
+
+    memcpy(dest, value, size);
+    size_t filled = size;
+    size_t total = size * count;
+    while (filled < total)
+    {
+        size_t step = std::min(filled, total - filled);
+        memcpy(dest + filled, dest, step);
+        filled += step;
+    }
+}
+
+std::vector<EntityID> Scene::SpawnBatch(const Prefab &prefab, u32 count)
+{
+    std::vector<EntityID> ids(count);
+
+    // Reuse free indices first, then grow the entity table once
+    u32 reused = std::min(count, (u32)freeIndices.size());
+    for (u32 i = 0; i < reused; i++)
+    {
+        u32 index = freeIndices.back();
+        freeIndices.pop_back();
+        ids[i] = CreateEntityId(index, GetEntityVersion(entities[index].id));
+    }
+    u32 first = (u32)entities.size();
+    entities.resize(first + count - reused);
+    for (u32 i = reused; i < count; i++)
+    {
+        ids[i] = CreateEntityId(first + i - reused, 0);
+    }
+
+    u32 archetypeIndex = GetArchetype(prefab.mask & ~looseMask);
+    Archetype *archetype = archetypes[archetypeIndex];
+    u32 done = 0;
+    while (done < count)
+    {
+        u32 row = archetype->count;
+        u32 chunk = row / archetype->chunkCapacity;
+        u32 slot = row % archetype->chunkCapacity;
+        if (chunk == archetype->chunks.size())
+        {
+            archetype->chunks.push_back(new u8[archetype->chunkBytes]);
+        }
+
+        u32 rows = std::min(archetype->chunkCapacity - slot, count - done);
+        memcpy(archetype->GetEntities(chunk) + slot, ids.data() + done, rows * sizeof(EntityID));
+        for (u32 column = 0; column < archetype->componentIds.size(); column++)
+        {
+            u32 componentId = archetype->componentIds[column];
+            u32 size = archetype->elementSizes[column];
+            FillRepeated((u8 *)archetype->GetColumn(chunk, componentId) + slot * size,
+                         prefab.Get(componentId), size, rows);
+            u32 *ticks = archetype->GetTicks(chunk, componentId) + slot;
+            std::fill(ticks, ticks + rows, changeTick);
+        }
+
+        for (u32 i = 0; i < rows; i++)
+        {
+            EntityID id = ids[done + i];
+            entities[GetEntityIndex(id)] = {id, prefab.mask, archetypeIndex, chunk, slot + i};
+        }
+        archetype->count += rows;
+        done += rows;
+    }
+
+    for (u32 componentId = 0; componentId < componentPools.size(); componentId++)
+    {
+        ComponentPool *pool = componentPools[componentId];
+        if (!pool || !prefab.mask.test(componentId))
+            continue;
+
+        for (EntityID id : ids)
+        {
+            memcpy(pool->Add(id), prefab.Get(componentId), pool->elementSize);
+            *pool->GetTick(GetEntityIndex(id)) = changeTick;
+        }
+    }
+
+    if ((prefab.mask & observedMask).any())
+    {
+        for (EntityID id : ids)
+        {
+            NotifyAssign(id, prefab.mask & observedMask);
+        }
+    }
+    return ids;
+}
+
+void Scene::DestroyEntity(EntityID id)
+{
+    EntityEntry &entry = entities[GetEntityIndex(id)];
+    if (entry.id != id)
+        return;
+
+    NotifyRemove(id, entry.mask & observedMask);
+
+    RemoveRow(*this, entry.archetype, entry.chunk, entry.slot);
+    for (u32 i = 0; i < componentPools.size(); i++)
+    {
+        if (componentPools[i] && entry.mask.test(i))
+        {
+            componentPools[i]->Remove(GetEntityIndex(id));
+        }
+    }
+
+    // Increments EntityVersion at the deleted index
+    EntityID newID = CreateEntityId((u32) (-1), GetEntityVersion(id) + 1);
+    entry.id = newID;
+    entry.mask.reset();
+    entry.archetype = INVALID_ARCHETYPE;
+    freeIndices.push_back(GetEntityIndex(id));
 }
 
-ComponentPool::~ComponentPool()
+bool Scene::IsAlive(EntityID id)
 {
-    delete[] pData;
+    u32 index = GetEntityIndex(id);
+    return IsEntityValid(id) && index < entities.size() && entities[index].id == id;
 }
 
-inline void *ComponentPool::get(size_t index)
+std::vector<EntityID> Scene::Compact()
 {
-    // looking up the component at the desired index
-    return pData + index * elementSize;
-}
+    std::vector<EntityID> remap(entities.size(), INVALID_ENTITY);
 
-/*
- * SCENE FUNCTIONALITY
- */
+    // Every live entity has a row, if only in the archetype with no
+    // components, so numbering the rows numbers all of them.
+    u32 next = 0;
+    for (Archetype *archetype : archetypes)
+    {
+        for (u32 chunk = 0; chunk * archetype->chunkCapacity < archetype->count; chunk++)
+        {
+            EntityID *ents = archetype->GetEntities(chunk);
+            for (u32 slot = 0; slot < archetype->ChunkCount(chunk); slot++)
+            {
+                EntityID id = CreateEntityId(next++, GetEntityVersion(ents[slot]));
+                remap[GetEntityIndex(ents[slot])] = id;
+                ents[slot] = id;
+            }
+        }
+    }
 
-// Each component has its own memory pool, to have good memory
-// locality. An entity's ID is the index into its own component in the
-// component pool.
-void Scene::AddSystem(System *sys)
-{
-    systems.push_back(sys);
+    std::vector<EntityEntry> packed(next);
+    for (u32 i = 0; i < entities.size(); i++)
+    {
+        if (remap[i] != INVALID_ENTITY)
+        {
+            EntityEntry &entry = packed[GetEntityIndex(remap[i])];
+            entry = entities[i];
+            entry.id = remap[i];
+        }
+    }
+    entities.swap(packed);
+    freeIndices = std::vector<u32>();
+
+    for (u32 componentId = 0; componentId < componentPools.size(); componentId++)
+    {
+        ComponentPool *oldPool = componentPools[componentId];
+        if (!oldPool)
+            continue;
+
+        std::vector<u32> order(oldPool->count);
+        for (u32 i = 0; i < oldPool->count; i++)
+        {
+            order[i] = i;
+        }
+        std::sort(order.begin(), order.end(), [&](u32 a, u32 b)
+        {
+            return GetEntityIndex(remap[GetEntityIndex(oldPool->dense[a])]) <
+                    GetEntityIndex(remap[GetEntityIndex(oldPool->dense[b])]);
+        });
+
+        ComponentPool *pool = new ComponentPool(oldPool->elementSize);
+        for (u32 i = 0; i < oldPool->count; i++)
+        {
+            u32 slot = order[i];
+            memcpy(pool->Add(remap[GetEntityIndex(oldPool->dense[slot])]),
+                   oldPool->pData + slot * oldPool->elementSize, oldPool->elementSize);
+            pool->ticks[i] = oldPool->ticks[slot];
+        }
+        componentPools[componentId] = pool;
+        delete oldPool;
+    }
+
+    // Fields declared as EntityID refer to other entities
+    for (u32 componentId = 0; componentId < componentLayouts.size(); componentId++)
+    {
+        std::vector<u32> offsets;
+        for (FieldLayout &field : componentLayouts[componentId].fields)
+        {
+            if (field.type == "EntityID")
+            {
+                offsets.push_back(field.offset);
+            }
+        }
+        if (offsets.empty())
+            continue;
+
+        auto remapFields = [&](u8 *component)
+        {
+            for (u32 offset : offsets)
+            {
+                EntityID id;
+                memcpy(&id, component + offset, sizeof(EntityID));
+                id = RemapEntity(remap, id);
+                memcpy(component + offset, &id, sizeof(EntityID));
+            }
+        };
+
+        if (ComponentPool *pool = componentPools[componentId])
+        {
+            for (u32 i = 0; i < pool->count; i++)
+            {
+                remapFields(pool->pData + i * pool->elementSize);
+            }
+            continue;
+        }
+
+        for (Archetype *archetype : archetypes)
+        {
+            if (archetype->columns[componentId] == INVALID_ARCHETYPE)
+                continue;
+
+            u32 size = archetype->elementSizes[archetype->columns[componentId]];
+            for (u32 chunk = 0; chunk * archetype->chunkCapacity < archetype->count; chunk++)
+            {
+                u8 *column = (u8 *)archetype->GetColumn(chunk, componentId);
+                for (u32 slot = 0; slot < archetype->ChunkCount(chunk); slot++)
+                {
+                    remapFields(column + slot * size);
+                }
+            }
+        }
+    }
+
+    for (System *sys : systems)
+    {
+        sys->OnCompact(this, remap);
+    }
+    compacted = true;
+
+    return remap;
 }
 
-void Scene::InitSystems()
+void *Scene::GetComponent(EntityID id, u32 componentId)
 {
-    for (System *sys : systems)
+    if (ComponentPool *pool = componentPools[componentId])
     {
-        sys->OnStart(this);
+        return pool->get(GetEntityIndex(id));
+    }
+
+    if (tagMask.test(componentId))
+    {
+        return &tagData;
     }
+
+    EntityEntry &entry = entities[GetEntityIndex(id)];
+    return archetypes[entry.archetype]->Get(entry.chunk, entry.slot, componentId);
 }
 
-void Scene::UpdateSystems(GameInput *input, f32 deltaTime)
+u32 *Scene::GetTick(EntityID id, u32 componentId)
 {
-    for (System *sys: systems)
+    if (ComponentPool *pool = componentPools[componentId])
     {
-        sys->OnUpdate(this, input, deltaTime);
+        return pool->GetTick(GetEntityIndex(id));
     }
+
+    EntityEntry &entry = entities[GetEntityIndex(id)];
+    return archetypes[entry.archetype]->GetTicks(entry.chunk, componentId) + entry.slot;
 }
 
-void Scene::AddComponentPool(size_t size)
+void Scene::NotifyAssign(EntityID id, ComponentMask components)
 {
-    componentPools.push_back(new ComponentPool(size));
+    for (u32 i = 0; components.any() && i < assignObservers.size(); i++)
+    {
+        if (!components.test(i))
+            continue;
+
+        void *component = GetComponent(id, i);
+        for (ComponentObserver &observer : assignObservers[i])
+        {
+            observer(id, component);
+        }
+        components.reset(i);
+    }
 }
 
-EntityID Scene::NewEntity()
+void Scene::NotifyRemove(EntityID id, ComponentMask components)
 {
-    // std::vector::size runs in constant time.
-    if (!freeIndices.empty())
+    for (u32 i = 0; components.any() && i < removeObservers.size(); i++)
     {
-        u32 newIndex = freeIndices.back();
-        freeIndices.pop_back();
-        // Takes in index and incremented EntityVersion at that index
-        EntityID newID = CreateEntityId(newIndex, GetEntityVersion(entities[newIndex].id));
-        entities[newIndex].id = newID;
-        return entities[newIndex].id;
+        if (!components.test(i))
+            continue;
+
+        void *component = GetComponent(id, i);
+        for (ComponentObserver &observer : removeObservers[i])
+        {
+            observer(id, component);
+        }
+        components.reset(i);
     }
-    entities.push_back({CreateEntityId((u32) (entities.size()), 0), ComponentMask()});
-    return entities.back().id;
 }
 
-void Scene::DestroyEntity(EntityID id)
+void Scene::Playback(CommandBuffer &buffer)
 {
-    // Increments EntityVersion at the deleted index
-    EntityID newID = CreateEntityId((u32) (-1), GetEntityVersion(id) + 1);
-    entities[GetEntityIndex(id)].id = newID;
-    entities[GetEntityIndex(id)].mask.reset();
-    freeIndices.push_back(GetEntityIndex(id));
+    // Create the pending entities first, so that commands can refer to
+    // them by their real IDs.
+    std::vector<EntityID> created(buffer.pendingCount);
+    for (u32 i = 0; i < buffer.pendingCount; i++)
+    {
+        created[i] = NewEntity();
+    }
+
+    std::vector<CommandBuffer::Command> &commands = buffer.commands;
+    for (CommandBuffer::Command &command : commands)
+    {
+        u32 index = GetEntityIndex(command.id);
+        if (index != (u32)(-1) && (index & PENDING_ENTITY_BIT))
+        {
+            command.id = created[index & ~PENDING_ENTITY_BIT];
+        }
+    }
+
+    // Group the commands by entity, keeping the order they were
+    // recorded in within each entity, and walk the entity table in order.
+    std::stable_sort(commands.begin(), commands.end(),
+                     [](const CommandBuffer::Command &a, const CommandBuffer::Command &b)
+                     {
+                         return GetEntityIndex(a.id) < GetEntityIndex(b.id);
+                     });
+
+    u32 start = 0;
+    while (start < commands.size())
+    {
+        EntityID id = commands[start].id;
+        u32 end = start;
+        while (end < commands.size() && GetEntityIndex(commands[end].id) == GetEntityIndex(id))
+        {
+            end++;
+        }
+
+        // Commands on entities destroyed before playback are dropped
+        EntityEntry &entry = entities[GetEntityIndex(id)];
+        ComponentMask mask = entry.mask;
+        ComponentMask assigned;
+        bool destroyed = false;
+        for (u32 i = start; i < end && !destroyed; i++)
+        {
+            CommandBuffer::Command &command = commands[i];
+            if (command.id != entry.id)
+                continue;
+
+            switch (command.type)
+            {
+            case CommandBuffer::ASSIGN_COMPONENT:
+                mask.set(command.componentId);
+                assigned.set(command.componentId);
+                break;
+            case CommandBuffer::REMOVE_COMPONENT:
+                mask.reset(command.componentId);
+                break;
+            case CommandBuffer::DESTROY_ENTITY:
+                destroyed = true;
+                break;
+            }
+        }
+
+        // Components that are removed or overwritten are observed
+        // before they go away. Destroying the entity observes its own.
+        assigned &= mask;
+        if (!destroyed)
+        {
+            NotifyRemove(entry.id, entry.mask & ~mask & observedMask);
+            NotifyRemove(entry.id, entry.mask & assigned & observedMask);
+        }
+
+        if (destroyed)
+        {
+            DestroyEntity(entry.id);
+        }
+        else if (mask != entry.mask)
+        {
+            ComponentMask archetypeMask = mask & ~looseMask;
+            if (archetypeMask != archetypes[entry.archetype]->mask)
+            {
+                MoveEntity(entry.id, GetArchetype(archetypeMask));
+            }
+
+            ComponentMask sparseChanges = (mask ^ entry.mask) & sparseMask;
+            for (u32 i = 0; i < componentPools.size(); i++)
+            {
+                if (!sparseChanges.test(i))
+                    continue;
+
+                if (mask.test(i))
+                {
+                    componentPools[i]->Add(entry.id);
+                }
+                else
+                {
+                    componentPools[i]->Remove(GetEntityIndex(entry.id));
+                }
+            }
+            entry.mask = mask;
+        }
+
+        // Write the assigned values, letting later ones win
+        for (u32 i = start; i < end && !destroyed; i++)
+        {
+            CommandBuffer::Command &command = commands[i];
+            if (command.type == CommandBuffer::ASSIGN_COMPONENT && command.id == entry.id &&
+                mask.test(command.componentId))
+            {
+                memcpy(GetComponent(entry.id, command.componentId),
+                       buffer.data.data() + command.dataOffset,
+                       componentSizes[command.componentId]);
+                if (!tagMask.test(command.componentId))
+                {
+                    *GetTick(entry.id, command.componentId) = changeTick;
+                }
+            }
+        }
+
+        if (!destroyed)
+        {
+            NotifyAssign(entry.id, assigned & observedMask);
+        }
+
+        start = end;
+    }
+
+    buffer.Clear();
 }
 
-// Helps with iterating through a given scene
+// How a SceneView hands out each of its component types. Plain types
+// are required, and handed out by reference. Optional<T> is handed out
+// as a pointer, which is null for entities without T.
+template<typename T>
+struct ViewTerm
+{
+    typedef T Component;
+    static constexpr bool required = true;
+    static_assert(!std::is_empty_v<T>, "Tags have no data to hand out, filter on them instead");
+
+    static T *Column(Archetype *pArchetype, u32 chunk)
+    {
+        return (T *)pArchetype->GetColumn(chunk, GetComponentId<T>());
+    }
+
+    static T &At(T *column, u32 slot, Scene *pScene, EntityID ent)
+    {
+        return column[slot];
+    }
+
+    static T &FromScene(Scene *pScene, EntityID ent)
+    {
+        return *pScene->Get<T>(ent);
+    }
+
+    static u32 *Ticks(Archetype *pArchetype, u32 chunk)
+    {
+        return pArchetype->GetTicks(chunk, GetComponentId<T>());
+    }
+
+    static bool ChangedSince(Scene *pScene, EntityID ent, u32 tick)
+    {
+        return *pScene->GetTick(ent, GetComponentId<T>()) >= tick;
+    }
+};
+
+template<typename T>
+struct ViewTerm<Optional<T>>
+{
+    typedef T Component;
+    static constexpr bool required = false;
+    static_assert(!std::is_empty_v<T>, "Tags have no data to hand out, filter on them instead");
+
+    // Null if the archetype does not hold the component, in which case
+    // the entities are asked one by one, as it may be in a sparse set.
+    static T *Column(Archetype *pArchetype, u32 chunk)
+    {
+        u32 componentId = GetComponentId<T>();
+        if (pArchetype->columns[componentId] == INVALID_ARCHETYPE)
+        {
+            return nullptr;
+        }
+        return (T *)pArchetype->GetColumn(chunk, componentId);
+    }
+
+    static T *At(T *column, u32 slot, Scene *pScene, EntityID ent)
+    {
+        return column ? column + slot : pScene->Get<T>(ent);
+    }
+
+    static T *FromScene(Scene *pScene, EntityID ent)
+    {
+        return pScene->Get<T>(ent);
+    }
+
+    static u32 *Ticks(Archetype *pArchetype, u32 chunk)
+    {
+        u32 componentId = GetComponentId<T>();
+        if (pArchetype->columns[componentId] == INVALID_ARCHETYPE)
+        {
+            return nullptr;
+        }
+        return pArchetype->GetTicks(chunk, componentId);
+    }
+
+    static bool ChangedSince(Scene *pScene, EntityID ent, u32 tick)
+    {
+        u32 componentId = GetComponentId<T>();
+        return pScene->entities[GetEntityIndex(ent)].mask.test(componentId) &&
+                *pScene->GetTick(ent, componentId) >= tick;
+    }
+};
+
+// Helps with iterating through a given scene. Views over archetype
+// stored components walk the archetypes their query has matched.
+// Views that include sparse set stored components instead walk the
+// smallest of their pools, and test the mask of each entity in it.
+// Besides the components it hands out, a view can be narrowed with a
+// filter, for example SceneView<A, Optional<B>>(scene,
+// QueryFilter().Without<C>()) visits the entities with A but not C,
+// and hands out their B if they have one. Tags have nothing to hand
+// out, so they only ever appear in the filter.
 template<typename... ComponentTypes>
 struct SceneView
 {
-    SceneView(Scene &scene) : pScene(&scene)
+    SceneView(Scene &scene, QueryFilter terms = QueryFilter()) : pScene(&scene), filter(terms)
     {
-        if (sizeof...(ComponentTypes) == 0)
+        // Unpack the template parameters into an initializer list
+        u32 componentIds[] = {0, GetComponentId<typename ViewTerm<ComponentTypes>::Component>()...};
+        bool required[] = {false, ViewTerm<ComponentTypes>::required...};
+        for (u32 i = 1; i < (sizeof...(ComponentTypes) + 1); i++)
+        {
+            if (required[i])
+            {
+                filter.with.set(componentIds[i]);
+            }
+        }
+
+        for (u32 i = 0; i < scene.componentPools.size(); i++)
         {
-            all = true;
+            ComponentPool *pool = scene.componentPools[i];
+            if (pool && filter.with.test(i) && (!pPool || pool->count < pPool->count))
+            {
+                pPool = pool;
+            }
         }
-        else
+
+        if (!pPool)
         {
-            // Unpack the template parameters into an initializer list
-            u32 componentIds[] = {0, GetComponentId<ComponentTypes>()...};
-            for (u32 i = 1; i < (sizeof...(ComponentTypes) + 1); i++)
-                componentMask.set(componentIds[i]);
+            pQuery = scene.GetQuery(filter);
+            exact = pQuery->exact;
         }
     }
 
     struct Iterator
     {
-        Iterator(Scene *pScene, u32 index, ComponentMask mask, bool all)
-                : pScene(pScene), index(index), mask(mask), all(all) {}
+        Iterator(Scene *pScene, Query *pQuery, ComponentPool *pPool, u32 archetype, const QueryFilter &filter, bool exact)
+                : pScene(pScene), pQuery(pQuery), pPool(pPool), archetype(archetype), filter(filter), exact(exact) {}
 
         // give back the entityID we're currently at
         EntityID operator*() const
         {
-            return pScene->entities[index].id;
+            return current;
+        }
+
+        bool AtEnd() const
+        {
+            if (pPool)
+            {
+                return index >= pPool->count;
+            }
+            return !pQuery || archetype >= pQuery->archetypes.size();
         }
 
         // Compare two iterators
         bool operator==(const Iterator &other) const
         {
-            return index == other.index || index == pScene->entities.size();
+            if (AtEnd() || other.AtEnd())
+            {
+                return AtEnd() == other.AtEnd();
+            }
+            return archetype == other.archetype && chunk == other.chunk &&
+                    slot == other.slot && index == other.index;
         }
 
         bool operator!=(const Iterator &other) const
         {
-            return index != other.index && index != pScene->entities.size();
+            return !(*this == other);
+        }
+
+        // Moves forward until the iterator rests on a matching entity,
+        // or runs out of entities.
+        void Seek()
+        {
+            if (pPool)
+            {
+                while (index < pPool->count)
+                {
+                    current = pPool->dense[index];
+                    if (filter.Matches(pScene->entities[GetEntityIndex(current)].mask))
+                    {
+                        return;
+                    }
+                    index++;
+                }
+                return;
+            }
+
+            while (archetype < pQuery->archetypes.size())
+            {
+                Archetype *pArchetype = pScene->archetypes[pQuery->archetypes[archetype]];
+                if (chunk * pArchetype->chunkCapacity + slot < pArchetype->count)
+                {
+                    current = pArchetype->GetEntities(chunk)[slot];
+                    if (exact || filter.Matches(pScene->entities[GetEntityIndex(current)].mask))
+                    {
+                        return;
+                    }
+                    Step(pArchetype);
+                    continue;
+                }
+                archetype++;
+                chunk = 0;
+                slot = 0;
+            }
         }
 
-        bool ValidIndex()
+        void Step(Archetype *pArchetype)
         {
-            return
-                // It's a valid entity ID
-                    IsEntityValid(pScene->entities[index].id) &&
-                    // It has the correct component mask
-                    (all || mask == (mask & pScene->entities[index].mask));
+            slot++;
+            if (slot == pArchetype->chunkCapacity)
+            {
+                slot = 0;
+                chunk++;
+            }
         }
 
         // Move the iterator forward
         Iterator &operator++()
         {
-            do
+            // If the entity we handed out has left its slot, the last
+            // slot was moved here, which still has to be visited.
+            if (pPool)
             {
-                index++;
-            } while (index < pScene->entities.size() && !ValidIndex());
+                if (index >= pPool->count || pPool->dense[index] == current)
+                {
+                    index++;
+                }
+                Seek();
+                return *this;
+            }
+
+            Archetype *pArchetype = pScene->archetypes[pQuery->archetypes[archetype]];
+            bool rowReplaced = chunk * pArchetype->chunkCapacity + slot < pArchetype->count &&
+                    pArchetype->GetEntities(chunk)[slot] != current;
+            if (!rowReplaced)
+            {
+                Step(pArchetype);
+            }
+            Seek();
             return *this;
         }
 
-        u32 index;
         Scene *pScene;
-        ComponentMask mask;
-        bool all{false};
+        Query *pQuery;
+        ComponentPool *pPool;
+        // Position in the query's list of archetypes
+        u32 archetype;
+        u32 chunk{0};
+        u32 slot{0};
+        u32 index{0};
+        EntityID current{INVALID_ENTITY};
+        QueryFilter filter;
+        bool exact;
     };
 
     // Give an iterator to the beginning of this view
     const Iterator begin() const
     {
-        int firstIndex = 0;
-        while (firstIndex < pScene->entities.size() &&
-               (componentMask != (componentMask & pScene->entities[firstIndex].mask)
-                || !IsEntityValid(pScene->entities[firstIndex].id)))
-        {
-            firstIndex++;
-        }
-        return Iterator(pScene, firstIndex, componentMask, all);
+        Iterator iterator(pScene, pQuery, pPool, 0, filter, exact);
+        iterator.Seek();
+        return iterator;
     }
 
     // Give an iterator to the end of this view
     const Iterator end() const
     {
-        return Iterator(pScene, (u32) (pScene->entities.size()), componentMask, all);
+        return Iterator(pScene, nullptr, nullptr, INVALID_ARCHETYPE, filter, exact);
+    }
+
+    bool Matches(EntityID ent) const
+    {
+        return filter.Matches(pScene->entities[GetEntityIndex(ent)].mask);
+    }
+
+    // Calls the given function with every matching entity, along with
+    // references to its components. Over archetypes, the columns of a
+    // chunk are looked up once and walked in lockstep, rather than
+    // looking up each component per entity.
+    // NOTE: Like the iterator, this may be used while adding and
+    // removing components, but the references given to the function
+    // are only valid until it makes such a change.
+    template<typename Func>
+    void Each(Func func) const
+    {
+        if (pPool)
+        {
+            u32 index = 0;
+            while (index < pPool->count)
+            {
+                EntityID ent = pPool->dense[index];
+                if (Matches(ent))
+                {
+                    func(ent, ViewTerm<ComponentTypes>::FromScene(pScene, ent)...);
+                }
+
+                // Visit the slot again if its entity was replaced
+                if (index >= pPool->count || pPool->dense[index] == ent)
+                {
+                    index++;
+                }
+            }
+            return;
+        }
+
+        for (u32 i = 0; i < pQuery->archetypes.size(); i++)
+        {
+            Archetype *pArchetype = pScene->archetypes[pQuery->archetypes[i]];
+            for (u32 chunk = 0; chunk * pArchetype->chunkCapacity < pArchetype->count; chunk++)
+            {
+                EachInChunk(func, pArchetype, chunk, pArchetype->GetEntities(chunk),
+                            ViewTerm<ComponentTypes>::Column(pArchetype, chunk)...);
+            }
+        }
+    }
+
+    // Like Each, but only visits entities where at least one of the
+    // view's components was assigned or marked changed at or after the
+    // given tick. Passing the scene's changeTick from the last time the
+    // caller looked gives the changes made since then.
+    // NOTE: The function must not make structural changes.
+    template<typename Func>
+    void EachChangedSince(u32 tick, Func func) const
+    {
+        constexpr u32 typeCount = sizeof...(ComponentTypes);
+        if (pPool)
+        {
+            for (u32 index = 0; index < pPool->count; index++)
+            {
+                EntityID ent = pPool->dense[index];
+                if (Matches(ent) && (ViewTerm<ComponentTypes>::ChangedSince(pScene, ent, tick) || ...))
+                {
+                    func(ent, ViewTerm<ComponentTypes>::FromScene(pScene, ent)...);
+                }
+            }
+            return;
+        }
+
+        for (u32 i = 0; i < pQuery->archetypes.size(); i++)
+        {
+            Archetype *pArchetype = pScene->archetypes[pQuery->archetypes[i]];
+            for (u32 chunk = 0; chunk * pArchetype->chunkCapacity < pArchetype->count; chunk++)
+            {
+                // Optional components the archetype lacks have no ticks,
+                // and are asked per entity.
+                u32 *ticks[typeCount] = {ViewTerm<ComponentTypes>::Ticks(pArchetype, chunk)...};
+                bool complete = true;
+                for (u32 t = 0; t < typeCount; t++)
+                {
+                    complete &= ticks[t] != nullptr;
+                }
+
+                EntityID *ents = pArchetype->GetEntities(chunk);
+                u32 count = pArchetype->ChunkCount(chunk);
+                for (u32 slot = 0; slot < count; slot++)
+                {
+                    EntityID ent = ents[slot];
+                    if (!exact && !Matches(ent))
+                        continue;
+
+                    bool changed = false;
+                    if (complete)
+                    {
+                        for (u32 t = 0; t < typeCount; t++)
+                        {
+                            changed |= ticks[t][slot] >= tick;
+                        }
+                    }
+                    else
+                    {
+                        changed = (ViewTerm<ComponentTypes>::ChangedSince(pScene, ent, tick) || ...);
+                    }
+
+                    if (changed)
+                    {
+                        func(ent, ViewTerm<ComponentTypes>::At(ViewTerm<ComponentTypes>::Column(pArchetype, chunk),
+                                                               slot, pScene, ent)...);
+                    }
+                }
+            }
+        }
+    }
+
+    // Number of entities in this view.
+    u32 Count() const
+    {
+        u32 result = 0;
+        if (pPool)
+        {
+            for (u32 i = 0; i < pPool->count; i++)
+            {
+                if (Matches(pPool->dense[i]))
+                {
+                    result++;
+                }
+            }
+            return result;
+        }
+
+        for (u32 archetype : pQuery->archetypes)
+        {
+            Archetype *pArchetype = pScene->archetypes[archetype];
+            if (exact)
+            {
+                result += pArchetype->count;
+                continue;
+            }
+
+            for (u32 chunk = 0; chunk * pArchetype->chunkCapacity < pArchetype->count; chunk++)
+            {
+                EntityID *ents = pArchetype->GetEntities(chunk);
+                for (u32 slot = 0; slot < pArchetype->ChunkCount(chunk); slot++)
+                {
+                    result += Matches(ents[slot]);
+                }
+            }
+        }
+        return result;
+    }
+
+    // Like Each, but hands the chunks of the view out as jobs, and waits
+    // for them to finish. The function also gets the entity's position
+    // in the order Each visits them, so results can be written to a
+    // fixed place no matter which thread produced them.
+    // NOTE: The function runs on several threads at once, so it must
+    // not make structural changes. Views that walk a sparse set pool
+    // are walked on the calling thread.
+    template<typename Func>
+    void ParallelEach(Func func) const
+    {
+        if (pPool || !jobSystem)
+        {
+            u32 index = 0;
+            Each([&](EntityID ent, auto &&...components)
+            {
+                func(index++, ent, components...);
+            });
+            return;
+        }
+
+        std::atomic<u32> remaining{0};
+        u32 first = 0;
+        for (u32 i = 0; i < pQuery->archetypes.size(); i++)
+        {
+            Archetype *pArchetype = pScene->archetypes[pQuery->archetypes[i]];
+            for (u32 chunk = 0; chunk * pArchetype->chunkCapacity < pArchetype->count; chunk++)
+            {
+                // Entities that have to be tested one by one are counted
+                // up front, so each job knows where its results go.
+                EntityID *ents = pArchetype->GetEntities(chunk);
+                u32 count = pArchetype->ChunkCount(chunk);
+                u32 matches = count;
+                for (u32 slot = 0; !exact && slot < count; slot++)
+                {
+                    matches -= !Matches(ents[slot]);
+                }
+                if (matches == 0)
+                    continue;
+
+                remaining++;
+                jobSystem->Push([this, &func, &remaining, pArchetype, chunk, first, count]
+                {
+                    EachInRange(func, first, count, pArchetype->GetEntities(chunk),
+                                ViewTerm<ComponentTypes>::Column(pArchetype, chunk)...);
+                    remaining--;
+                });
+                first += matches;
+            }
+        }
+
+        // Help out rather than block, as this may itself run as a job
+        while (remaining > 0)
+        {
+            if (!jobSystem->TryRunJob())
+            {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    template<typename Func>
+    void EachInRange(Func &func, u32 first, u32 count, EntityID *ents,
+                     typename ViewTerm<ComponentTypes>::Component *...columns) const
+    {
+        u32 index = first;
+        for (u32 slot = 0; slot < count; slot++)
+        {
+            if (exact || Matches(ents[slot]))
+            {
+                func(index++, ents[slot], ViewTerm<ComponentTypes>::At(columns, slot, pScene, ents[slot])...);
+            }
+        }
+    }
+
+    template<typename Func>
+    void EachInChunk(Func &func, Archetype *pArchetype, u32 chunk, EntityID *ents,
+                     typename ViewTerm<ComponentTypes>::Component *...columns) const
+    {
+        u32 first = chunk * pArchetype->chunkCapacity;
+        u32 slot = 0;
+        while (slot < pArchetype->chunkCapacity && first + slot < pArchetype->count)
+        {
+            EntityID ent = ents[slot];
+            if (exact || Matches(ent))
+            {
+                func(ent, ViewTerm<ComponentTypes>::At(columns, slot, pScene, ent)...);
+            }
+
+            // Visit the slot again if its row was replaced
+            if (first + slot >= pArchetype->count || ents[slot] == ent)
+            {
+                slot++;
+            }
+        }
     }
 
     Scene *pScene{nullptr};
-    ComponentMask componentMask;
-    bool all{false};
+    Query *pQuery{nullptr};
+    // The smallest pool among the required components, if any are
+    // stored in sparse sets.
+    ComponentPool *pPool{nullptr};
+    QueryFilter filter;
+    // Whether every entity of the query's archetypes matches, so that
+    // the filter does not have to be tested per entity.
+    bool exact{true};
 };
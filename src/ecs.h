@@ -2,15 +2,191 @@
 
 #include <vector>
 #include <typeinfo>
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <mutex>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 /*
  * TYPE DEFINITIONS AND CONSTANTS
  */
 
 typedef u64 EntityID;
-constexpr u32 MAX_COMPONENTS = 32;
-typedef std::bitset<MAX_COMPONENTS> ComponentMask;
+#ifndef SKL_MAX_COMPONENTS
+#define SKL_MAX_COMPONENTS 128
+#endif
+constexpr u32 MAX_COMPONENTS = SKL_MAX_COMPONENTS;
+// Sparse set pools reserve address space for this many entities up
+// front, and only commit memory as they fill up. WebAssembly has no
+// way to reserve memory without backing it, so the limit stays small
+// there.
+#if EMSCRIPTEN
 constexpr u32 MAX_ENTITIES = 32768;
+#else
+constexpr u32 MAX_ENTITIES = 1 << 24;
+#endif
+
+/*
+ * COMPONENT MASK
+ */
+
+// One bit per component ID. Masks are mostly combined and compared as
+// a whole, so the bits are kept in 64 bit words, which are worked on
+// all at once.
+struct ComponentMask
+{
+    static constexpr u32 WORD_COUNT = (MAX_COMPONENTS + 63) / 64;
+    u64 words[WORD_COUNT] = {};
+
+    bool test(u32 index) const
+    {
+        return (words[index / 64] >> (index % 64)) & 1;
+    }
+
+    bool operator[](u32 index) const
+    {
+        return test(index);
+    }
+
+    ComponentMask &set(u32 index)
+    {
+        words[index / 64] |= 1ull << (index % 64);
+        return *this;
+    }
+
+    ComponentMask &reset(u32 index)
+    {
+        words[index / 64] &= ~(1ull << (index % 64));
+        return *this;
+    }
+
+    ComponentMask &reset()
+    {
+        *this = ComponentMask();
+        return *this;
+    }
+
+    bool any() const
+    {
+        u64 bits = 0;
+        for (u32 i = 0; i < WORD_COUNT; i++)
+        {
+            bits |= words[i];
+        }
+        return bits != 0;
+    }
+
+    bool none() const
+    {
+        return !any();
+    }
+
+    ComponentMask &operator&=(const ComponentMask &other)
+    {
+        for (u32 i = 0; i < WORD_COUNT; i++)
+        {
+            words[i] &= other.words[i];
+        }
+        return *this;
+    }
+
+    ComponentMask &operator|=(const ComponentMask &other)
+    {
+        for (u32 i = 0; i < WORD_COUNT; i++)
+        {
+            words[i] |= other.words[i];
+        }
+        return *this;
+    }
+
+    ComponentMask &operator^=(const ComponentMask &other)
+    {
+        for (u32 i = 0; i < WORD_COUNT; i++)
+        {
+            words[i] ^= other.words[i];
+        }
+        return *this;
+    }
+
+    ComponentMask operator~() const
+    {
+        ComponentMask result;
+        for (u32 i = 0; i < WORD_COUNT; i++)
+        {
+            result.words[i] = ~words[i];
+        }
+        return result;
+    }
+
+    bool operator==(const ComponentMask &other) const = default;
+};
+
+inline ComponentMask operator&(ComponentMask a, const ComponentMask &b)
+{
+    return a &= b;
+}
+
+inline ComponentMask operator|(ComponentMask a, const ComponentMask &b)
+{
+    return a |= b;
+}
+
+inline ComponentMask operator^(ComponentMask a, const ComponentMask &b)
+{
+    return a ^= b;
+}
+
+template<>
+struct std::hash<ComponentMask>
+{
+    size_t operator()(const ComponentMask &mask) const
+    {
+        u64 hash = 0;
+        for (u32 i = 0; i < ComponentMask::WORD_COUNT; i++)
+        {
+            hash = (hash ^ mask.words[i]) * 0x9E3779B97F4A7C15ull;
+        }
+        return (size_t)(hash ^ (hash >> 32));
+    }
+};
+
+// Whether the mask has all of the required bits and none of the
+// excluded ones, as well as one of the any of bits if there are any.
+// Up to two words, plain 64 bit operations beat SSE, which needs a
+// compare and movemask per term to get a result out. 256 bit masks are
+// tested in one AVX2 register where it is available. The parts are
+// combined without branching, as whether entities match tends to be
+// unpredictable.
+local inline bool MaskMatches(const ComponentMask &mask, const ComponentMask &required,
+                              const ComponentMask &excluded, const ComponentMask &anyOf)
+{
+#if defined(__AVX2__)
+    if constexpr (ComponentMask::WORD_COUNT == 4)
+    {
+        __m256i m = _mm256_loadu_si256((const __m256i *)mask.words);
+        __m256i r = _mm256_loadu_si256((const __m256i *)required.words);
+        __m256i e = _mm256_loadu_si256((const __m256i *)excluded.words);
+        __m256i a = _mm256_loadu_si256((const __m256i *)anyOf.words);
+        __m256i bad = _mm256_or_si256(_mm256_andnot_si256(m, r), _mm256_and_si256(m, e));
+        return _mm256_testz_si256(bad, bad) & (_mm256_testz_si256(a, a) | !_mm256_testz_si256(m, a));
+    }
+#endif
+
+    u64 bad = 0;
+    u64 hits = 0;
+    u64 anyBits = 0;
+    for (u32 i = 0; i < ComponentMask::WORD_COUNT; i++)
+    {
+        bad |= (required.words[i] & ~mask.words[i]) | (excluded.words[i] & mask.words[i]);
+        hits |= anyOf.words[i] & mask.words[i];
+        anyBits |= anyOf.words[i];
+    }
+    return (bad == 0) & ((anyBits == 0) | (hits != 0));
+}
 
 /*
  * ID FUNCTIONALITY
@@ -32,6 +208,11 @@ local inline bool IsEntityValid(EntityID id);
 
 #define INVALID_ENTITY CreateEntityId((u32)(-1), 0)
 
+// Looks up the new ID of an entity in a table returned by
+// Scene::Compact. Entities that had been destroyed map to
+// INVALID_ENTITY.
+local inline EntityID RemapEntity(const std::vector<EntityID> &remap, EntityID id);
+
 //////////////// COMPONENTS ////////////////
 
 // NOTE(marvin): GetId has been moved to plaform layer, so that the
@@ -41,45 +222,140 @@ local inline bool IsEntityValid(EntityID id);
  * COMPONENT POOL
  */
 
-// Responsible for allocating contiguous memory for the components
-// such that `MAX_ENTITIES` can be stored, and components be accessed
-// via index.
+// Where the components of a type are stored. Archetype storage packs
+// components that are usually accessed together, while sparse set
+// storage keeps components that are frequently added and removed out
+// of the archetypes, so churn on them never moves an entity's other
+// components around. Tags carry no data, and only take up their bit in
+// the entity's mask, so assigning and removing them is a bit operation.
+enum ComponentStorage
+{
+    ARCHETYPE,
+    SPARSE_SET,
+    TAG
+};
+
+// Responsible for the components of one sparse set stored type. The
+// sparse table maps an entity index to a slot in the dense arrays,
+// which keep the components and their entities packed together, so
+// walking the pool only visits entities that have the component.
 // NOTE: The memory pool is an array of bytes, as the size of one
 // component isn't known at compile time.
+// NOTE: Each array is a reserved range of virtual memory big enough
+// for MAX_ENTITIES, of which only the front is committed. Components
+// therefore never move as the pool grows.
 struct ComponentPool
 {
     u8 *pData{nullptr};
     size_t elementSize{0};
 
+    u32 *sparse{nullptr};
+    EntityID *dense{nullptr};
+    // The change tick of each slot's component.
+    u32 *ticks{nullptr};
+    u32 count{0};
+
+    // Number of bytes committed at the front of each array.
+    size_t dataCommitted{0};
+    size_t sparseCommitted{0};
+    size_t denseCommitted{0};
+    size_t ticksCommitted{0};
+
     ComponentPool(size_t elementsize);
 
     ~ComponentPool();
 
-    // Gets the component in this pData at the given index.
-    inline void *get(size_t index);
+    inline bool Has(u32 index);
+
+    // Gets the component of the entity at the given index.
+    inline void *get(u32 index);
+
+    inline u32 *GetTick(u32 index);
+
+    // Gives the entity a slot at the end of the dense arrays, and
+    // returns its component.
+    void *Add(EntityID id);
+
+    // Removes the component of the entity at the given index, by
+    // moving the last slot into its place.
+    void Remove(u32 index);
 };
 
 /*
- * SYSTEM
+ * ARCHETYPE
  */
 
-struct Scene;
-
-// A system in our ECS, which defines operations on a subset of
-// entities, using scene view.
-class System
+// Size in bytes of one block of archetype storage.
+constexpr u32 ARCHETYPE_CHUNK_SIZE = 16 * 1024;
+constexpr u32 INVALID_ARCHETYPE = (u32)(-1);
+
+// An archetype owns every entity that has exactly the same component
+// mask. Its entities live in fixed-size chunks, where each chunk holds
+// the IDs of its entities followed by one contiguous column per
+// component. Walking an archetype therefore only touches densely
+// packed components of entities that actually match. The component
+// columns are followed by a column of change ticks per component.
+// NOTE: Removing a row moves the last row of the archetype into the
+// hole, so pointers into an archetype are only stable until the next
+// structural change of an entity in it.
+struct Archetype
 {
-public:
-    virtual void OnStart(Scene *scene) {};
-    virtual void OnUpdate(Scene *scene, GameInput *input, f32 deltaTime) {};
-    virtual ~System() = default;
+    ComponentMask mask;
+
+    // The component IDs stored in this archetype, in ascending order,
+    // along with the byte offset of their column within a chunk.
+    std::vector<u32> componentIds;
+    std::vector<u32> columnOffsets;
+    std::vector<u32> tickOffsets;
+    std::vector<u32> elementSizes;
+
+    // Maps a component ID to its column in this archetype.
+    u32 columns[MAX_COMPONENTS];
+
+    // Archetypes reached by adding or removing a component, filled in
+    // lazily so that repeated transitions skip the mask lookup.
+    u32 addEdges[MAX_COMPONENTS];
+    u32 removeEdges[MAX_COMPONENTS];
+
+    std::vector<u8 *> chunks;
+    u32 chunkCapacity{0};
+    u32 chunkBytes{0};
+    u32 count{0};
+
+    Archetype(ComponentMask componentMask, std::vector<size_t> &componentSizes);
+
+    ~Archetype();
+
+    // Number of occupied slots in the given chunk.
+    inline u32 ChunkCount(u32 chunk);
+
+    inline EntityID *GetEntities(u32 chunk);
+
+    // Gets the start of the column of the given component in the given chunk.
+    inline void *GetColumn(u32 chunk, u32 componentId);
+
+    inline void *Get(u32 chunk, u32 slot, u32 componentId);
+
+    // Gets the start of the change ticks of the given component in the given chunk.
+    inline u32 *GetTicks(u32 chunk, u32 componentId);
 };
 
+// The component registry. It is filled in once per game module by
+// RegisterComponents and shared by every scene, which only read it, so
+// scenes on different threads can look components up freely.
 local u32 numComponents = 0;
+constexpr u32 INVALID_COMPONENT = (u32)(-1);
 
 template<typename T>
 const char *compName;
 
+// Each component type's ID is cached in its own slot, so that looking
+// it up is a single load rather than a string hash. The slots live in
+// the game module, so RegisterComponents binds them again after a hot
+// reload.
+template<typename T>
+u32 cachedComponentId = INVALID_COMPONENT;
+
 // NOTE(marvin): The reason why this is separated out from the struct
 // is to mirror the prior implementation where it was also separated
 // out from the struct. Honestly, could just integrate it.
@@ -87,31 +363,289 @@ local std::unordered_map<std::string, u32> stringToId;
 
 local u32 MakeComponentId(std::string name)
 {
+    if (numComponents == MAX_COMPONENTS)
+    {
+        printf("Too many components, raise SKL_MAX_COMPONENTS to register %s\n", name.c_str());
+        exit(1);
+    }
     stringToId[name] = numComponents;
     return numComponents++;
 }
 
 template<typename T>
-local u32 GetComponentId()
+local inline u32 GetComponentId()
+{
+    Assert(cachedComponentId<T> != INVALID_COMPONENT);
+    return cachedComponentId<T>;
+}
+
+/*
+ * QUERY
+ */
+
+// Which entities a query matches, by their component mask: those with
+// all of the with components, none of the without components, and at
+// least one of the any of components if there are any.
+struct QueryFilter
 {
-    if (auto search = stringToId.find(compName<T>);
-            search != stringToId.end())
+    ComponentMask with;
+    ComponentMask without;
+    ComponentMask anyOf;
+
+    template<typename... ComponentTypes>
+    QueryFilter &With()
     {
-        u64 count = search->second;
-        return count;
+        (with.set(GetComponentId<ComponentTypes>()), ...);
+        return *this;
     }
 
-    printf("Invalid component ID\n");
-    exit(1);
-}
+    template<typename... ComponentTypes>
+    QueryFilter &Without()
+    {
+        (without.set(GetComponentId<ComponentTypes>()), ...);
+        return *this;
+    }
+
+    template<typename... ComponentTypes>
+    QueryFilter &AnyOf()
+    {
+        (anyOf.set(GetComponentId<ComponentTypes>()), ...);
+        return *this;
+    }
+
+    bool Matches(const ComponentMask &mask) const
+    {
+        return MaskMatches(mask, with, without, anyOf);
+    }
+
+    bool operator==(const QueryFilter &other) const = default;
+};
+
+struct QueryFilterHash
+{
+    size_t operator()(const QueryFilter &filter) const
+    {
+        std::hash<ComponentMask> hash;
+        return hash(filter.with) ^ (hash(filter.without) * 31) ^ (hash(filter.anyOf) * 131);
+    }
+};
+
+// Marks a component of a SceneView that entities may lack. The view
+// hands it out as a pointer, which is null for entities without it.
+template<typename T>
+struct Optional {};
+
+// A registered filter, which remembers the archetypes it matches.
+// Entities only ever move between archetypes the query already knows
+// about, so the cache only has to be updated when an archetype is
+// created.
+struct Query
+{
+    QueryFilter filter;
+    std::vector<u32> archetypes;
+    // Whether every entity in the matched archetypes matches. Archetype
+    // masks leave out sparse set components and tags, so terms on those
+    // have to be tested per entity.
+    bool exact;
+};
+
+/*
+ * COMMAND BUFFER
+ */
+
+// Entities created through a command buffer get a placeholder ID with
+// this bit set in their index, until the buffer is played back.
+constexpr u32 PENDING_ENTITY_BIT = 1u << 31;
+
+// Records structural changes to a scene, so that they can be applied
+// together at a sync point with Scene::Playback, rather than moving
+// components around while a system is iterating over them.
+// NOTE: A command buffer is not thread safe. Threads that record
+// changes should each fill their own buffer.
+struct CommandBuffer
+{
+    enum CommandType
+    {
+        ASSIGN_COMPONENT,
+        REMOVE_COMPONENT,
+        DESTROY_ENTITY
+    };
+
+    struct Command
+    {
+        CommandType type;
+        EntityID id;
+        u32 componentId;
+        // Where the assigned value of the component starts in data.
+        u32 dataOffset;
+    };
+
+    std::vector<Command> commands;
+    std::vector<u8> data;
+    // Number of entities to create before the commands are applied.
+    u32 pendingCount{0};
+
+    // Returns a placeholder ID for an entity that will be created on
+    // playback. The placeholder can be used in later commands of this
+    // buffer.
+    EntityID NewEntity();
+
+    void DestroyEntity(EntityID id);
+
+    // Records that the entity gets the given value of a component.
+    template<typename T>
+    void Assign(EntityID id, const T &component = T())
+    {
+        u32 offset = (u32) data.size();
+        data.resize(offset + sizeof(T));
+        memcpy(data.data() + offset, &component, sizeof(T));
+        commands.push_back({ASSIGN_COMPONENT, id, GetComponentId<T>(), offset});
+    }
+
+    template<typename T>
+    void Remove(EntityID id)
+    {
+        commands.push_back({REMOVE_COMPONENT, id, GetComponentId<T>(), 0});
+    }
+
+    bool IsEmpty();
+
+    void Clear();
+};
+
+/*
+ * PREFAB
+ */
+
+// A set of components along with their starting values, for spawning
+// many entities that start out alike with Scene::SpawnBatch.
+struct Prefab
+{
+    ComponentMask mask;
+    // Where each component's value starts in data.
+    u32 offsets[MAX_COMPONENTS];
+    std::vector<u8> data;
+
+    // Adds the component to the prefab, or replaces its value.
+    template<typename T>
+    Prefab &With(const T &component = T())
+    {
+        u32 componentId = GetComponentId<T>();
+        if (!mask.test(componentId))
+        {
+            mask.set(componentId);
+            offsets[componentId] = (u32)data.size();
+            data.resize(data.size() + sizeof(T));
+        }
+        memcpy(data.data() + offsets[componentId], &component, sizeof(T));
+        return *this;
+    }
+
+    const u8 *Get(u32 componentId) const
+    {
+        return data.data() + offsets[componentId];
+    }
+};
+
+/*
+ * SYSTEM
+ */
+
+struct Scene;
+
+// Components that a system reads and writes on the entities that have
+// all of the components in the with mask.
+struct SystemAccess
+{
+    ComponentMask with;
+    ComponentMask reads;
+    ComponentMask writes;
+
+    template<typename... ComponentTypes>
+    SystemAccess &Writes()
+    {
+        u32 componentIds[] = {0, GetComponentId<ComponentTypes>()...};
+        for (u32 i = 1; i < (sizeof...(ComponentTypes) + 1); i++)
+        {
+            writes.set(componentIds[i]);
+        }
+        return *this;
+    }
+};
+
+// A system in our ECS, which defines operations on a subset of
+// entities, using scene view.
+// Systems that declare the components they access may run at the same
+// time as the systems whose accesses do not conflict with theirs.
+// Systems that declare nothing are assumed to touch anything, and run
+// alone. While systems run, structural changes have to go through the
+// system's command buffer, which is played back once they are done.
+class System
+{
+public:
+    std::vector<SystemAccess> accesses;
+    // Whether the system has to run on the main thread, such as when it
+    // talks to the renderer or the platform.
+    bool runOnMainThread{false};
+    CommandBuffer commands;
+
+    virtual void OnStart(Scene *scene) {};
+    virtual void OnUpdate(Scene *scene, GameInput *input, f32 deltaTime) {};
+    // Called once Scene::Compact has renumbered the entities, with its
+    // table from old entity index to new ID. Systems that hold on to
+    // entity IDs between frames remap them here with RemapEntity.
+    virtual void OnCompact(Scene *scene, const std::vector<EntityID> &remap) {};
+    virtual ~System() = default;
+
+    // Declares that the system reads the given components on the
+    // entities that have all of them. Chain with Writes to declare the
+    // components among them that it also writes.
+    template<typename... ComponentTypes>
+    SystemAccess &Access()
+    {
+        SystemAccess access;
+        u32 componentIds[] = {0, GetComponentId<ComponentTypes>()...};
+        for (u32 i = 1; i < (sizeof...(ComponentTypes) + 1); i++)
+        {
+            access.with.set(componentIds[i]);
+        }
+        access.reads = access.with;
+        accesses.push_back(access);
+        return accesses.back();
+    }
+};
 
 /*
  * SCENE DEFINITION
  */
 
-// Each component has its own memory pool, to have good memory
-// locality. An entity's ID is the index into its own component in the
-// component pool.
+// Called with an entity and one of its components, when the entity
+// gains or is about to lose that component.
+typedef std::function<void(EntityID, void *)> ComponentObserver;
+
+// Layout of a component as declared in components.h. The scene keeps
+// the layout its data was written with, so that a hot reloaded game
+// module can tell which components changed.
+struct FieldLayout
+{
+    std::string name;
+    std::string type;
+    u32 offset;
+    u32 size;
+};
+
+struct ComponentLayout
+{
+    std::string name;
+    u64 hash;
+    std::vector<FieldLayout> fields;
+};
+
+// Entities are grouped into archetypes by their component mask, to
+// have good memory locality. An entity's ID indexes into the entity
+// table, which records where its components live. Components stored
+// in sparse sets are left out of the archetype masks, and are found
+// through their pool instead.
 struct Scene
 {
     struct EntityEntry
@@ -119,28 +653,170 @@ struct Scene
         EntityID id; // though redundent with index in vector, required
         // for deleting entities,
         ComponentMask mask;
+
+        // Location of the entity's components.
+        u32 archetype;
+        u32 chunk;
+        u32 slot;
     };
 
     std::vector<EntityEntry> entities;
+    std::vector<Archetype *> archetypes;
+    std::unordered_map<ComponentMask, u32> archetypeIndices;
+    std::vector<size_t> componentSizes;
+    std::vector<ComponentLayout> componentLayouts;
+    // Pools of the sparse set stored components, null for components
+    // that live in archetypes.
     std::vector<ComponentPool *> componentPools;
+    ComponentMask sparseMask;
+    ComponentMask tagMask;
+    // Components left out of the archetype masks, which are the sparse
+    // set stored ones and tags.
+    ComponentMask looseMask;
+    // Tags have no data, so every tag hands out a pointer to this.
+    u8 tagData{0};
+    std::vector<Query *> queries;
+    std::unordered_map<QueryFilter, u32, QueryFilterHash> queryIndices;
+    // Systems running at the same time build their views, and so look
+    // up and register queries, together.
+    std::mutex queryMutex;
     std::vector<u32> freeIndices;
+    // Added with AddSystem, and deleted along with the scene.
     std::vector<System *> systems;
-
+    // Advanced once per frame. Components that are assigned or marked
+    // as changed take on the current tick.
+    u32 changeTick{1};
+    // Observers of each component ID, and the components that have any.
+    std::vector<std::vector<ComponentObserver>> assignObservers;
+    std::vector<std::vector<ComponentObserver>> removeObservers;
+    ComponentMask observedMask;
+    // Whether Compact has run. Kept with the scene rather than the game
+    // module, so that it survives hot reloads.
+    bool compacted{false};
+
+    Scene() = default;
+
+    // Frees the archetypes, pools, queries and systems of the scene.
+    ~Scene();
+
+    // The scene owns its storage through pointers, which two copies
+    // would both free.
+    Scene(const Scene &) = delete;
+    Scene &operator=(const Scene &) = delete;
+
+    // Adds a system, which the scene takes ownership of.
     void AddSystem(System *sys);
       
     void InitSystems();
 
+    // Runs the systems for one frame. Each system waits for the systems
+    // added before it whose accesses conflict with its own, and the
+    // rest are spread over the job system.
     void UpdateSystems(GameInput *input, f32 deltaTime);
 
-    void AddComponentPool(size_t size);
+    // Whether any entity has all of the given components.
+    bool AnyEntityMatches(ComponentMask mask);
+
+    void AddComponentType(size_t size, ComponentStorage storage = ARCHETYPE);
+
+    ComponentStorage GetStorage(u32 componentId);
+
+    // Changes the size of a component, rebuilding its pool or the
+    // archetypes that hold it. The migrate function is called with the
+    // new storage and the old data of each instance of the component.
+    void MigrateComponent(u32 componentId, size_t size,
+                          const std::function<void(void *, void *)> &migrate);
+
+    // Returns the index of the archetype with the given mask, creating
+    // it if it does not exist yet.
+    u32 GetArchetype(ComponentMask mask);
+
+    // Returns the query for the given filter, registering it and
+    // matching it against the existing archetypes if it does not exist
+    // yet. Safe to call from several systems at once.
+    Query *GetQuery(const QueryFilter &filter);
+
+    // Moves the given entity into the given archetype, carrying over
+    // the components both archetypes have in common.
+    void MoveEntity(EntityID id, u32 archetypeIndex);
 
     // Adds a new entity to this vector of entities, and returns its
     // ID. Can only support 2^64 entities without ID conflicts.
     EntityID NewEntity();
 
+    // Creates the given number of entities with the prefab's
+    // components, and returns their IDs. The entities go straight into
+    // their final archetype, whose columns are filled a chunk at a
+    // time, rather than moving each entity once per component.
+    std::vector<EntityID> SpawnBatch(const Prefab &prefab, u32 count);
+
     // Removes a given entity from the scene and signals to the scene the free space that was left behind
     void DestroyEntity(EntityID id);
 
+    // Whether the ID refers to an entity that has not been destroyed.
+    bool IsAlive(EntityID id);
+
+    // Renumbers the live entities so that they fill the front of the
+    // entity table, in the order their rows are stored, and drops the
+    // free indices. Sparse set pools are rebuilt in the same order,
+    // which hands back the memory they grew to. Returns a table from
+    // each old entity index to the entity's new ID, for RemapEntity.
+    // EntityID fields of components are remapped along the way, and
+    // the systems get the table through OnCompact. IDs held anywhere
+    // else must be remapped by their owner.
+    // NOTE: Must not run while systems update or while command buffers
+    // hold commands, as those refer to the old IDs.
+    std::vector<EntityID> Compact();
+
+    // Applies the changes recorded in the given command buffer, and
+    // clears it. Commands are grouped by entity, so that each entity
+    // moves to its final archetype at most once.
+    void Playback(CommandBuffer &buffer);
+
+    // Returns the component with the given ID on the given entity,
+    // which must have it.
+    void *GetComponent(EntityID id, u32 componentId);
+
+    // Returns the change tick of the component with the given ID on the
+    // given entity, which must have it.
+    u32 *GetTick(EntityID id, u32 componentId);
+
+    // Runs the assign or remove observers of the given components on
+    // the entity, which must have them.
+    void NotifyAssign(EntityID id, ComponentMask components);
+    void NotifyRemove(EntityID id, ComponentMask components);
+
+    // Registers a function to be called with (EntityID, T &) whenever an
+    // entity gains the component. Components assigned directly are
+    // observed in their default state, while ones assigned through a
+    // command buffer are observed with their assigned value.
+    // Reassigning a component counts as removing the old one first.
+    // NOTE: Observers run in the middle of structural changes, so they
+    // must not make any themselves. Record them in a command buffer.
+    template<typename T, typename Func>
+    void OnAssign(Func func)
+    {
+        u32 componentId = GetComponentId<T>();
+        assignObservers[componentId].push_back([func](EntityID id, void *component)
+        {
+            func(id, *(T *)component);
+        });
+        observedMask.set(componentId);
+    }
+
+    // Registers a function to be called with (EntityID, T &) before an
+    // entity loses the component, including when it is destroyed.
+    template<typename T, typename Func>
+    void OnRemove(Func func)
+    {
+        u32 componentId = GetComponentId<T>();
+        removeObservers[componentId].push_back([func](EntityID id, void *component)
+        {
+            func(id, *(T *)component);
+        });
+        observedMask.set(componentId);
+    }
+
     // Removes a component from the entity with the given EntityID
     // if the EntityID is not already removed.
     template<typename T>
@@ -150,20 +826,51 @@ struct Scene
         if (entities[GetEntityIndex(id)].id != id)
             return;
 
-        int componentId = GetComponentId<T>();
-        // Finds location of component data within the entity component pool and
-        // resets, thus removing the component from the entity
-        entities[GetEntityIndex(id)].mask.reset(componentId);
+        u32 componentId = GetComponentId<T>();
+        EntityEntry &entry = entities[GetEntityIndex(id)];
+        if (!entry.mask.test(componentId))
+            return;
+
+        if (observedMask.test(componentId))
+        {
+            NotifyRemove(id, ComponentMask().set(componentId));
+        }
+
+        if (ComponentPool *pool = componentPools[componentId])
+        {
+            pool->Remove(GetEntityIndex(id));
+            entry.mask.reset(componentId);
+            return;
+        }
+
+        if (tagMask.test(componentId))
+        {
+            entry.mask.reset(componentId);
+            return;
+        }
+
+        // Moves the entity into the archetype without the component,
+        // which drops its data.
+        Archetype *archetype = archetypes[entry.archetype];
+        u32 target = archetype->removeEdges[componentId];
+        if (target == INVALID_ARCHETYPE)
+        {
+            ComponentMask mask = archetype->mask;
+            mask.reset(componentId);
+            target = GetArchetype(mask);
+            archetype->removeEdges[componentId] = target;
+        }
+        MoveEntity(id, target);
     }
 
     // Assigns the entity associated with the given entity ID in this
     // vector of entities a new instance of the given component. Then,
-    // adds it to its corresponding memory pool, and returns a pointer
-    // to it.
+    // moves it to the archetype holding that component, and returns a
+    // pointer to it.
     template<typename T>
     T *Assign(EntityID id)
     {
-        int componentId = GetComponentId<T>();
+        u32 componentId = GetComponentId<T>();
 
         if (numComponents <= componentId) // Invalid component
         {
@@ -171,10 +878,58 @@ struct Scene
             exit(1);
         }
 
-        // Looks up the component in the pool, and initializes it with placement new
-        T *pComponent = new(componentPools[componentId]->get(GetEntityIndex(id))) T();
+        EntityEntry &entry = entities[GetEntityIndex(id)];
+        bool observed = observedMask.test(componentId);
+        if (observed && entry.mask.test(componentId))
+        {
+            NotifyRemove(id, ComponentMask().set(componentId));
+        }
+
+        if (ComponentPool *pool = componentPools[componentId])
+        {
+            void *pData = entry.mask.test(componentId) ? pool->get(GetEntityIndex(id)) : pool->Add(id);
+            entry.mask.set(componentId);
+            *pool->GetTick(GetEntityIndex(id)) = changeTick;
+            T *pComponent = new(pData) T();
+            if (observed)
+            {
+                NotifyAssign(id, ComponentMask().set(componentId));
+            }
+            return pComponent;
+        }
+
+        if (tagMask.test(componentId))
+        {
+            entry.mask.set(componentId);
+            if (observed)
+            {
+                NotifyAssign(id, ComponentMask().set(componentId));
+            }
+            return (T *)&tagData;
+        }
 
-        entities[GetEntityIndex(id)].mask.set(componentId);
+        if (!entry.mask.test(componentId))
+        {
+            Archetype *archetype = archetypes[entry.archetype];
+            u32 target = archetype->addEdges[componentId];
+            if (target == INVALID_ARCHETYPE)
+            {
+                ComponentMask mask = archetype->mask;
+                mask.set(componentId);
+                target = GetArchetype(mask);
+                archetype->addEdges[componentId] = target;
+            }
+            MoveEntity(id, target);
+        }
+
+        // Looks up the component in its archetype, and initializes it with placement new
+        Archetype *archetype = archetypes[entry.archetype];
+        T *pComponent = new(archetype->Get(entry.chunk, entry.slot, componentId)) T();
+        archetype->GetTicks(entry.chunk, componentId)[entry.slot] = changeTick;
+        if (observed)
+        {
+            NotifyAssign(id, ComponentMask().set(componentId));
+        }
         return pComponent;
     }
 
@@ -185,11 +940,52 @@ struct Scene
     template<typename T>
     T *Get(EntityID id)
     {
-        int componentId = GetComponentId<T>();
-        if (!entities[GetEntityIndex(id)].mask.test(componentId))
+        u32 componentId = GetComponentId<T>();
+        EntityEntry &entry = entities[GetEntityIndex(id)];
+        if (!entry.mask[componentId])
             return nullptr;
 
-        T *pComponent = static_cast<T *>(componentPools[componentId]->get(GetEntityIndex(id)));
+        if (ComponentPool *pool = componentPools[componentId])
+        {
+            return static_cast<T *>(pool->get(GetEntityIndex(id)));
+        }
+
+        if (tagMask[componentId])
+        {
+            return (T *)&tagData;
+        }
+
+        T *pComponent = static_cast<T *>(archetypes[entry.archetype]->Get(entry.chunk, entry.slot, componentId));
         return pComponent;
     }
+
+    // Records that the given component of the entity was written to in
+    // this frame. Tags have no change ticks.
+    template<typename T>
+    void MarkChanged(EntityID id)
+    {
+        u32 componentId = GetComponentId<T>();
+        if (entities[GetEntityIndex(id)].mask[componentId] && !tagMask[componentId])
+        {
+            *GetTick(id, componentId) = changeTick;
+        }
+    }
+
+    // Like Get, but for components that are about to be written to, so
+    // it marks the component as changed.
+    template<typename T>
+    T *GetMutable(EntityID id)
+    {
+        MarkChanged<T>(id);
+        return Get<T>(id);
+    }
 };
+
+// Runs one frame of each of the given scenes, and waits for all of
+// them. Scenes share nothing but the component registry, which is only
+// read once registered, so each scene's frame is handed out as a job,
+// and its systems are in turn spread over the job system.
+// NOTE: Systems that run on the main thread run on whichever thread
+// steps their scene, so scenes stepped here must not talk to the
+// renderer.
+void UpdateScenes(const std::vector<Scene *> &scenes, GameInput *input, f32 deltaTime);
@@ -7,8 +7,12 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #include "renderer/render_backend.h"
+#if SKL_RENDERER == 2
+#include "renderer/null_backend/renderer_null.h"
+#endif
 #include "asset_types.h"
 
+#include "job_system.cpp"
 #include "ecs.cpp"
 
 #include "math/skl_math_utils.h"
@@ -17,6 +21,7 @@
 global_variable PlatformAPI globalPlatformAPI;
 
 #include "scene_loader.cpp"
+#include "scene_snapshot.cpp"
 
 #include "physics.cpp"
 #include "systems.cpp"
@@ -29,7 +34,8 @@ __declspec(dllexport)
 #endif
 GAME_INITIALIZE(GameInitialize)
 {
-    RegisterComponents(scene);
+    RegisterComponents();
+    AddComponentTypes(scene);
 
     globalPlatformAPI = platformAPI;
 
@@ -38,6 +44,12 @@ GAME_INITIALIZE(GameInitialize)
 
     LoadScene(scene, "scenes/city.toml");
 
+#if SKL_CHECK_SNAPSHOTS
+    // Snapshots copy components byte for byte, so check that the starting
+    // scene comes back the same from one. Opt in with SKL_CHECK_SNAPSHOTS.
+    CheckSceneSnapshot(scene, "scene_check.skls");
+#endif
+
     bool slowStep = false;
 
     // NOTE(marvin): Initialising the physics system.
@@ -61,12 +73,18 @@ GAME_INITIALIZE(GameInitialize)
                         *sklBroadPhaseLayer, *sklObjectVsBroadPhaseLayerFilter,
                         *sklObjectLayerPairFilter);
 
+    jobSystem = new JobSystem(DefaultWorkerCount());
+
     CharacterControllerSystem *characterControllerSys = new CharacterControllerSystem(physicsSystem);
     scene.AddSystem(characterControllerSys);
 
+    TransformSystem *transformSys = new TransformSystem();
+    scene.AddSystem(transformSys);
+
     RenderSystem *renderSys = new RenderSystem();
     MovementSystem *movementSys = new MovementSystem();
-    BuilderSystem *builderSys = new BuilderSystem(slowStep);
+    u32 citySeed = 1;
+    BuilderSystem *builderSys = new BuilderSystem(slowStep, citySeed);
     scene.AddSystem(renderSys);
     scene.AddSystem(movementSys);
     scene.AddSystem(builderSys);
@@ -103,10 +121,45 @@ __declspec(dllexport)
 #endif
 GAME_UPDATE_AND_RENDER(GameUpdateAndRender)
 {
+    // NOTE: GameInitialize only runs for the first module loaded, so a
+    // hot reloaded module binds its component IDs here instead.
+    if (!componentsRegistered)
+    {
+        RegisterComponents();
+        AddComponentTypes(scene);
+    }
+
+    // The last module's workers were joined before it was unloaded, so
+    // a hot reloaded module starts its own.
+    if (!jobSystem)
+    {
+        jobSystem = new JobSystem(DefaultWorkerCount());
+    }
+
     scene.UpdateSystems(&input, deltaTime);
+
+    // Generating the city churns through plane components, so the scene
+    // is packed once the last plane has been built on.
+    if (!scene.compacted && SceneView<Plane>(scene).Count() == 0)
+    {
+        scene.Compact();
+    }
+
     LogDebugRecords();
 }
 
+extern "C"
+#if defined(_WIN32) || defined(_WIN64)
+__declspec(dllexport)
+#endif
+GAME_UNLOAD(GameUnload)
+{
+    // The workers are parked in this module's code, which is about to
+    // go away.
+    delete jobSystem;
+    jobSystem = nullptr;
+}
+
 // NOTE(marvin): This has to go after ALL the timed blocks in order of
 // what the preprocesser sees, so that the counter here will be the
 // number of all the timed blocks that it has seen.
@@ -133,6 +186,15 @@ local void LogDebugRecords()
                hitCount,
                cycleCount / hitCount);
     }
+
+#if SKL_RENDERER == 2
+    const NullRenderStats& renderStats = GetNullRenderStats();
+    printf("render: %u passes %u draws %u instances %llu bytes\n",
+           renderStats.passes,
+           renderStats.draws,
+           renderStats.instances,
+           (unsigned long long)renderStats.bytesUploaded);
+#endif
     puts("\n");
 #endif
 }
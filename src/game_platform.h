@@ -7,7 +7,6 @@
 #include "platform_metrics.cpp"
 #endif
 
-#include <bitset>   // For ECS
 #include <unordered_map>
 #include <string>
 #include <set>
@@ -49,3 +48,8 @@ typedef GAME_INITIALIZE(game_initialize_t);
 
 #define GAME_UPDATE_AND_RENDER(name) void name(Scene &scene, GameInput &input, f32 deltaTime)
 typedef GAME_UPDATE_AND_RENDER(game_update_and_render_t);
+
+// Called before the game module is unloaded, for a hot reload or on
+// exit, to stop anything still running the module's code.
+#define GAME_UNLOAD(name) void name(Scene &scene)
+typedef GAME_UNLOAD(game_unload_t);
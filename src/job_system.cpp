@@ -0,0 +1,207 @@
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <atomic>
+
+/*
+ * JOB SYSTEM
+ */
+
+typedef std::function<void()> Job;
+
+struct JobQueue
+{
+    std::mutex mutex;
+    std::deque<Job> jobs;
+};
+
+// A pool of worker threads that run jobs pushed from any thread. Every
+// worker has its own queue, which it pushes to and takes from at the
+// back, and steals from the front of the other queues when it runs
+// dry. Threads outside the pool share one more queue. The thread
+// waiting on work can help out by running queued jobs itself, so a job
+// system with no workers still makes progress. The workers run code of
+// the game module, so the module joins them in GameUnload before the
+// platform unloads it.
+struct JobSystem
+{
+    std::vector<std::thread> workers;
+    // Queue 0 belongs to the threads outside the pool, and queue i to
+    // worker i.
+    std::vector<JobQueue *> queues;
+    std::atomic<u32> queued{0};
+
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool running{true};
+
+    JobSystem(u32 workerCount);
+
+    ~JobSystem();
+
+    void Push(Job job);
+
+    // Runs one queued job on the calling thread. Returns false if there
+    // was nothing to run.
+    bool TryRunJob();
+};
+
+// Index of the calling thread's queue.
+thread_local u32 jobQueueIndex = 0;
+
+// Leaves one core for the main thread. WebAssembly builds are not
+// compiled with thread support, so all the work happens on the main
+// thread there.
+local u32 DefaultWorkerCount()
+{
+#if EMSCRIPTEN
+    return 0;
+#else
+    u32 cores = std::thread::hardware_concurrency();
+    return cores > 1 ? cores - 1 : 0;
+#endif
+}
+
+local void WorkerLoop(JobSystem *jobs, u32 index)
+{
+    jobQueueIndex = index;
+    for (;;)
+    {
+        if (jobs->TryRunJob())
+        {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(jobs->sleepMutex);
+        jobs->wake.wait(lock, [jobs] { return !jobs->running || jobs->queued > 0; });
+        if (!jobs->running && jobs->queued == 0)
+        {
+            return;
+        }
+    }
+}
+
+JobSystem::JobSystem(u32 workerCount)
+{
+    for (u32 i = 0; i <= workerCount; i++)
+    {
+        queues.push_back(new JobQueue());
+    }
+    for (u32 i = 1; i <= workerCount; i++)
+    {
+        workers.emplace_back(WorkerLoop, this, i);
+    }
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        running = false;
+    }
+    wake.notify_all();
+    for (std::thread &worker : workers)
+    {
+        worker.join();
+    }
+    for (JobQueue *queue : queues)
+    {
+        delete queue;
+    }
+}
+
+void JobSystem::Push(Job job)
+{
+    JobQueue *queue = queues[jobQueueIndex];
+    {
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        queue->jobs.push_back(std::move(job));
+    }
+    queued++;
+
+    // Taking the lock makes sure a worker that just found nothing to do
+    // is either asleep or will see the new job.
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wake.notify_one();
+}
+
+bool JobSystem::TryRunJob()
+{
+    Job job;
+    u32 own = jobQueueIndex;
+    {
+        JobQueue *queue = queues[own];
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        if (!queue->jobs.empty())
+        {
+            job = std::move(queue->jobs.back());
+            queue->jobs.pop_back();
+        }
+    }
+
+    // Steal the oldest job of another queue
+    for (u32 i = 1; !job && i < queues.size(); i++)
+    {
+        JobQueue *queue = queues[(own + i) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue->mutex);
+        if (!queue->jobs.empty())
+        {
+            job = std::move(queue->jobs.front());
+            queue->jobs.pop_front();
+        }
+    }
+
+    if (!job)
+    {
+        return false;
+    }
+
+    queued--;
+    job();
+    return true;
+}
+
+global_variable JobSystem *jobSystem = nullptr;
+
+// Calls the given function with every index below count, handing out
+// batches of the given size as jobs, and waits for them to finish.
+template<typename Func>
+void ParallelFor(u32 count, u32 batchSize, Func func)
+{
+    if (!jobSystem || count <= batchSize)
+    {
+        for (u32 i = 0; i < count; i++)
+        {
+            func(i);
+        }
+        return;
+    }
+
+    std::atomic<u32> remaining{0};
+    for (u32 first = 0; first < count; first += batchSize)
+    {
+        u32 last = std::min(first + batchSize, count);
+        remaining++;
+        jobSystem->Push([&func, &remaining, first, last]
+        {
+            for (u32 i = first; i < last; i++)
+            {
+                func(i);
+            }
+            remaining--;
+        });
+    }
+
+    // Help out rather than block, as this may itself run as a job
+    while (remaining > 0)
+    {
+        if (!jobSystem->TryRunJob())
+        {
+            std::this_thread::yield();
+        }
+    }
+}
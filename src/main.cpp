@@ -103,7 +103,8 @@ local SDLGameCode SDLLoadGameCode(SDL_Time newFileLastWritten)
 
     result.gameInitialize = (game_initialize_t *)SDL_LoadFunction(result.sharedObjectHandle, "GameInitialize");
     result.gameUpdateAndRender = (game_update_and_render_t *)SDL_LoadFunction(result.sharedObjectHandle, "GameUpdateAndRender");
-    if (result.gameInitialize && result.gameUpdateAndRender)
+    result.gameUnload = (game_unload_t *)SDL_LoadFunction(result.sharedObjectHandle, "GameUnload");
+    if (result.gameInitialize && result.gameUpdateAndRender && result.gameUnload)
     {
         result.fileLastWritten = newFileLastWritten;
     }
@@ -112,6 +113,7 @@ local SDLGameCode SDLLoadGameCode(SDL_Time newFileLastWritten)
         LOG_ERROR("Unable to load symbols from game shared object.");
         result.gameInitialize = 0;
         result.gameUpdateAndRender = 0;
+        result.gameUnload = 0;
 
     }
     return result;
@@ -132,6 +134,7 @@ local void SDLUnloadGameCode(SDLGameCode *gameCode)
     }
     gameCode->gameInitialize = 0;
     gameCode->gameUpdateAndRender = 0;
+    gameCode->gameUnload = 0;
 }
 
 local b32 SDLGameCodeChanged(SDLGameCode *gameCode)
@@ -158,6 +161,10 @@ void updateLoop(void* appInfo) {
     SDLGameCode gameCode = info->gameCode;
     if (SDLGameCodeChanged(&gameCode))
     {
+        if (gameCode.gameUnload)
+        {
+            gameCode.gameUnload(info->scene);
+        }
         SDLUnloadGameCode(&gameCode);
         info->gameCode = SDLLoadGameCode(gameCode.fileNewLastWritten_);
         gameCode = info->gameCode;
@@ -258,7 +265,9 @@ int main()
     platformAPI.platformLoadMeshAsset = &LoadMeshAsset;
     platformAPI.platformLoadTextureAsset = &LoadTextureAsset;
 
-    Scene scene;
+    // The scene's storage and systems are freed by code of the game
+    // module, so the platform keeps the scene until the process exits.
+    Scene &scene = *new Scene();
     gameCode.gameInitialize(scene, gameMemory, platformAPI);
 
     SDL_Event e;
@@ -280,6 +289,10 @@ int main()
     {
         updateLoop(&app);
     }
+    if (app.gameCode.gameUnload)
+    {
+        app.gameCode.gameUnload(scene);
+    }
     #endif
     SDL_DestroyWindow(window);
     SDL_Quit();
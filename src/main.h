@@ -9,6 +9,7 @@ struct SDLGameCode
   
     game_initialize_t *gameInitialize;
     game_update_and_render_t *gameUpdateAndRender;
+    game_unload_t *gameUnload;
 };
 
 struct AppInformation
@@ -75,6 +75,12 @@ f32 RandInBetween(f32 LO, f32 HI)
     return LO + static_cast<f32>(rand()) / (static_cast<f32>(RAND_MAX / (HI - LO)));
 }
 
+f32 RandInBetween(std::mt19937 &rng, f32 LO, f32 HI)
+{
+    std::uniform_real_distribution<f32> distribution(LO, HI);
+    return distribution(rng);
+}
+
 u32 RandInt(u32 min, u32 max)
 {
     std::random_device rd;
@@ -83,6 +89,12 @@ u32 RandInt(u32 min, u32 max)
     return distribution(gen);
 }
 
+u32 RandInt(std::mt19937 &rng, u32 min, u32 max)
+{
+    std::uniform_int_distribution<u32> distribution(min, max);
+    return distribution(rng);
+}
+
 glm::vec3 GetArbitraryOrthogonal(const glm::vec3& vec) {
   if (std::abs(vec.x) < std::abs(vec.y) && std::abs(vec.x) < std::abs(vec.z)) {
     return glm::normalize(glm::cross(vec, glm::vec3(1, 0, 0)));
@@ -125,4 +137,22 @@ std::vector<glm::vec4> GetFrustumCorners(const glm::mat4& proj, const glm::mat4&
     }
 
     return frustumCorners;
+}
+
+void GetFrustumPlanes(const glm::mat4& proj, const glm::mat4& view, glm::vec4 *planes)
+{
+    glm::mat4 m = glm::transpose(proj * view);
+
+    // Clip space depth goes from 0 to w
+    planes[0] = m[3] + m[0];
+    planes[1] = m[3] - m[0];
+    planes[2] = m[3] + m[1];
+    planes[3] = m[3] - m[1];
+    planes[4] = m[2];
+    planes[5] = m[3] - m[2];
+
+    for (u32 i = 0; i < 6; i++)
+    {
+        planes[i] /= glm::length(glm::vec3(planes[i]));
+    }
 }
\ No newline at end of file
@@ -8,6 +8,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <vector>
+#include <random>
 
 glm::vec3 GetArbitraryOrthogonal(const glm::vec3& vec);
 
@@ -30,11 +31,23 @@ void GetPointViews(Transform3D *transform, glm::mat4 *views);
 // floats.
 f32 RandInBetween(f32 LO, f32 HI);
 
+// Like RandInBetween, but drawing from the given generator, so that
+// the results only depend on its seed.
+f32 RandInBetween(std::mt19937 &rng, f32 LO, f32 HI);
+
 u32 RandInt(u32 min, u32 max);
 
+// Like RandInt, but drawing from the given generator.
+u32 RandInt(std::mt19937 &rng, u32 min, u32 max);
+
 // Generates a normalized vector orthogonal to the given one arbitrary (no guarantee of anything else other than orthogonal normalized nature)
 glm::vec3 GetArbitraryOrthogonal(const glm::vec3& vec);
 
 glm::mat4x4 GetMatrixSpace(const glm::vec3& forward, const glm::vec3& up, const glm::vec3& right);
 
-std::vector<glm::vec4> GetFrustumCorners(const glm::mat4& proj, const glm::mat4& view);
\ No newline at end of file
+std::vector<glm::vec4> GetFrustumCorners(const glm::mat4& proj, const glm::mat4& view);
+
+// Gets the six planes bounding the view of the given matrices, facing
+// inwards, as (normal, distance) with normalized normals. A point p is
+// inside when dot(plane.xyz, p) + plane.w >= 0 for all of them.
+void GetFrustumPlanes(const glm::mat4& proj, const glm::mat4& view, glm::vec4 *planes);
\ No newline at end of file
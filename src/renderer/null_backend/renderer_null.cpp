@@ -0,0 +1,542 @@
+#include "meta_definitions.h"
+
+#include "asset_types.h"
+#include "renderer/render_backend.h"
+#include "renderer/null_backend/renderer_null.h"
+
+#include <limits>
+#include <unordered_map>
+
+#if SKL_ENABLED_EDITOR
+#include <imgui.h>
+#endif
+
+#include "math/skl_math_consts.h"
+#include "math/skl_math_utils.h"
+
+#include "renderer/render_instances.cpp"
+
+#define NUM_FRAMES 2
+#define NUM_CASCADES 6
+
+// Represents a mesh the backend pretends to hold on the GPU
+struct NullMesh
+{
+    u32 vertCount;
+    u32 indexCount;
+    MeshBounds bounds;
+};
+
+struct NullTexture
+{
+    u32 width;
+    u32 height;
+};
+
+struct NullLightEntry
+{
+    u32 viewCount;
+};
+
+// The layouts below match what the Vulkan backend sends, so the bytes
+// counted here are what a real frame would upload.
+struct NullDirLightData
+{
+    glm::vec3 direction;
+    u32 shadowIndex;
+
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+};
+
+struct NullSpotLightData
+{
+    glm::mat4 lightSpace;
+
+    glm::vec3 position;
+    glm::vec3 direction;
+    u32 shadowIndex;
+
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+
+    f32 innerCutoff;
+    f32 outerCutoff;
+    f32 range;
+};
+
+struct NullPointLightData
+{
+    glm::vec3 position;
+    u32 shadowIndex;
+
+    glm::vec3 diffuse;
+    glm::vec3 specular;
+
+    f32 constant;
+    f32 linear;
+    f32 quadratic;
+
+    f32 maxRange;
+};
+
+struct NullLightCascade
+{
+    glm::mat4 lightSpace;
+    f32 maxDepth;
+};
+
+SDL_Window *nullWindow;
+u32 nullWidth;
+u32 nullHeight;
+
+MeshID currentMeshID;
+std::unordered_map<MeshID,NullMesh> meshes;
+TextureID currentTexID;
+std::unordered_map<TextureID,NullTexture> textures;
+LightID currentLightID;
+std::unordered_map<LightID,NullLightEntry> lights;
+InstanceTable instances;
+// The instances each view sees this frame, the main camera's and then
+// each shadow pass's
+std::vector<u32> culledDrawList;
+std::vector<DrawBatch> culledBatches;
+
+// Stand-ins for the per frame GPU buffers
+u32 frameNum;
+std::vector<ObjectData> objectBuffers[NUM_FRAMES];
+std::vector<u32> drawListBuffers[NUM_FRAMES];
+std::vector<CameraData> cameraBuffer;
+
+std::vector<NullCommand> commands;
+NullRenderStats frameStats;
+NullRenderStats lastFrameStats;
+
+u32 currentIndexCount;
+
+const NullRenderStats& GetNullRenderStats()
+{
+    return lastFrameStats;
+}
+
+const std::vector<NullCommand>& GetNullCommandStream()
+{
+    return commands;
+}
+
+SDL_WindowFlags GetRenderWindowFlags()
+{
+    // Nothing is ever presented. Run with SDL_VIDEO_DRIVER=offscreen or
+    // dummy on machines without a display.
+    return SDL_WINDOW_HIDDEN;
+}
+
+void InitRenderer(RenderInitInfo& info)
+{
+    nullWindow = info.window;
+    nullWidth = info.startWidth;
+    nullHeight = info.startHeight;
+
+    instances.Init(NUM_FRAMES);
+}
+
+void InitPipelines(RenderPipelineInitInfo& info)
+{
+}
+
+MeshID UploadMesh(RenderUploadMeshInfo& info)
+{
+    currentMeshID++;
+    meshes[currentMeshID] = {info.vertSize, info.idxSize, info.bounds};
+    instances.meshSpheres[currentMeshID] = info.bounds.sphere;
+    frameStats.bytesUploaded += sizeof(Vertex) * info.vertSize + sizeof(u32) * info.idxSize;
+
+    return currentMeshID;
+}
+
+MeshBounds GetMeshBounds(MeshID meshID)
+{
+    auto search = meshes.find(meshID);
+    return search != meshes.end() ? search->second.bounds : MeshBounds{};
+}
+
+void DestroyMesh(RenderDestroyMeshInfo& info)
+{
+    meshes.erase(info.meshID);
+    instances.meshSpheres.erase(info.meshID);
+}
+
+TextureID UploadTexture(RenderUploadTextureInfo& info)
+{
+    textures[currentTexID] = {info.width, info.height};
+    frameStats.bytesUploaded += sizeof(u32) * info.width * info.height;
+
+    return currentTexID++;
+}
+
+InstanceID AddInstance()
+{
+    return instances.Add();
+}
+
+void UpdateInstance(InstanceID instanceID, MeshRenderInfo& info)
+{
+    instances.Update(instanceID, info);
+}
+
+void DestroyInstance(InstanceID instanceID)
+{
+    instances.Destroy(instanceID);
+}
+
+LightID AddLight(u32 viewCount)
+{
+    currentLightID++;
+    lights[currentLightID] = {viewCount};
+
+    return currentLightID;
+}
+
+LightID AddDirLight()
+{
+    return AddLight(NUM_CASCADES);
+}
+
+LightID AddSpotLight()
+{
+    return AddLight(1);
+}
+
+LightID AddPointLight()
+{
+    return AddLight(6);
+}
+
+void DestroyDirLight(LightID lightID)
+{
+    lights.erase(lightID);
+}
+
+void DestroySpotLight(LightID lightID)
+{
+    lights.erase(lightID);
+}
+
+void DestroyPointLight(LightID lightID)
+{
+    lights.erase(lightID);
+}
+
+void Record(NullCommandType type, u32 a = 0, u32 b = 0, u32 c = 0)
+{
+    commands.push_back({type, a, b, c});
+}
+
+void BeginPass(NullPassType pass, LightID lightID)
+{
+    Record(BEGIN_PASS, pass, (u32)lightID);
+    frameStats.passes++;
+}
+
+void EndPass()
+{
+    Record(END_PASS);
+}
+
+// Appends the views to this frame's camera buffer and binds them
+void SetCamera(u32 viewCount, CameraData* views)
+{
+    Record(SET_CAMERA, (u32)cameraBuffer.size(), viewCount);
+    cameraBuffer.insert(cameraBuffer.end(), views, views + viewCount);
+    frameStats.bytesUploaded += sizeof(CameraData) * viewCount;
+}
+
+void SetLights(u32 dirCount, NullDirLightData* dirData,
+               u32 spotCount, NullSpotLightData* spotData,
+               u32 pointCount, NullPointLightData* pointData)
+{
+    Record(SET_LIGHTS, dirCount, spotCount, pointCount);
+    frameStats.bytesUploaded += sizeof(NullDirLightData) * dirCount
+                              + sizeof(NullSpotLightData) * spotCount
+                              + sizeof(NullPointLightData) * pointCount;
+    if (dirCount > 0)
+    {
+        frameStats.bytesUploaded += sizeof(NullLightCascade) * NUM_CASCADES;
+    }
+}
+
+// Copies the render instances that changed since this frame was last
+// drawn and the culled draw lists, as the Vulkan backend does
+void UploadInstances()
+{
+    std::vector<ObjectData>& objectBuffer = objectBuffers[frameNum];
+    if (objectBuffer.size() < instances.objects.size())
+    {
+        objectBuffer = instances.objects;
+        frameStats.bytesUploaded += sizeof(ObjectData) * objectBuffer.size();
+    }
+    else
+    {
+        for (InstanceID id : instances.dirty[frameNum])
+        {
+            objectBuffer[id] = instances.objects[id];
+        }
+        frameStats.bytesUploaded += sizeof(ObjectData) * instances.dirty[frameNum].size();
+    }
+    instances.ClearDirty(frameNum);
+
+    std::vector<u32>& drawList = drawListBuffers[frameNum];
+    bool writeDrawList = instances.TakeDrawList(frameNum);
+    u32 drawListSize = instances.drawCount + culledDrawList.size();
+    if (drawList.size() < drawListSize)
+    {
+        drawList.resize(drawListSize);
+        writeDrawList = true;
+    }
+    if (writeDrawList)
+    {
+        instances.WriteDrawList(drawList.data());
+        frameStats.bytesUploaded += sizeof(InstanceID) * instances.drawCount;
+    }
+    std::copy(culledDrawList.begin(), culledDrawList.end(), drawList.begin() + instances.drawCount);
+    frameStats.bytesUploaded += sizeof(u32) * culledDrawList.size();
+}
+
+void SetMesh(MeshID meshIndex)
+{
+    currentIndexCount = meshes[meshIndex].indexCount;
+    Record(SET_MESH, (u32)meshIndex, currentIndexCount);
+}
+
+void DrawObjects(u32 count, u32 startIndex)
+{
+    Record(DRAW_INSTANCED, count, startIndex);
+    frameStats.draws++;
+    frameStats.instances += count;
+}
+
+// Records a range of this frame's culled batches
+void DrawBatches(BatchRange range)
+{
+    for (u32 i = range.first; i < range.first + range.count; i++)
+    {
+        DrawBatch& batch = culledBatches[i];
+        SetMesh(batch.mesh);
+        DrawObjects(batch.count, instances.drawCount + batch.first);
+    }
+}
+
+void RenderUpdate(RenderFrameInfo& info)
+{
+    commands.clear();
+    cameraBuffer.clear();
+
+    if (nullWindow)
+    {
+        int width, height;
+        SDL_GetWindowSizeInPixels(nullWindow, &width, &height);
+        if (width > 0 && height > 0)
+        {
+            nullWidth = width;
+            nullHeight = height;
+        }
+    }
+
+    Transform3D cameraTransform = info.cameraTransform;
+    glm::mat4 view = GetViewMatrix(&cameraTransform);
+    f32 aspect = (f32)nullWidth / (f32)nullHeight;
+
+    glm::mat4 proj = glm::perspective(glm::radians(info.cameraFov), aspect, info.cameraNear, info.cameraFar);
+
+    // Every view is culled before any pass is recorded, as in the Vulkan
+    // backend
+    culledDrawList.clear();
+    culledBatches.clear();
+
+    glm::vec4 planes[6];
+    GetFrustumPlanes(proj, view, planes);
+    BatchRange mainBatches = instances.Cull(planes, 6, culledDrawList, culledBatches);
+
+    std::vector<CameraData> dirViews;
+    std::vector<BatchRange> dirBatches;
+
+    f32 subFrustumSize = (info.cameraFar - info.cameraNear) / NUM_CASCADES;
+
+    std::vector<NullLightCascade> cascades;
+
+    for (DirLightRenderInfo& dirInfo : info.dirLights)
+    {
+        f32 currentNear = info.cameraNear;
+
+        Transform3D dirTransform = dirInfo.transform;
+        glm::mat4 dirView = GetViewMatrix(&dirTransform);
+
+        glm::vec3 boxMin(std::numeric_limits<f32>::max());
+        glm::vec3 boxMax(std::numeric_limits<f32>::lowest());
+
+        for (int i = 0; i < NUM_CASCADES; i++)
+        {
+            glm::mat4 subProj = glm::perspective(glm::radians(info.cameraFov), aspect,
+                                                 currentNear, currentNear + subFrustumSize);
+            currentNear += subFrustumSize;
+
+            glm::vec3 lo(std::numeric_limits<f32>::max());
+            glm::vec3 hi(std::numeric_limits<f32>::lowest());
+
+            std::vector<glm::vec4> corners = GetFrustumCorners(subProj, view);
+            for (const glm::vec4& v : corners)
+            {
+                glm::vec3 trf = dirView * glm::vec4(glm::vec3(v), 1.0);
+                lo = glm::min(lo, trf);
+                hi = glm::max(hi, trf);
+            }
+
+            glm::mat4 dirProj = glm::ortho(lo.x, hi.x, lo.y, hi.y, lo.z, hi.z);
+
+            dirViews.push_back({dirView, dirProj, {}});
+
+            cascades.push_back({dirProj * dirView, currentNear});
+
+            boxMin = glm::min(boxMin, lo);
+            boxMax = glm::max(boxMax, hi);
+        }
+
+        // One list for all the cascades, open towards the light
+        glm::mat4 boxProj = glm::ortho(boxMin.x, boxMax.x, boxMin.y, boxMax.y, boxMin.z, boxMax.z);
+        GetFrustumPlanes(boxProj, dirView, planes);
+        planes[4] = planes[5];
+        dirBatches.push_back(instances.Cull(planes, 5, culledDrawList, culledBatches));
+    }
+
+    std::vector<CameraData> spotViews;
+    std::vector<BatchRange> spotBatches;
+
+    for (SpotLightRenderInfo& spotInfo : info.spotLights)
+    {
+        Transform3D spotTransform = spotInfo.transform;
+        glm::mat4 spotView = GetViewMatrix(&spotTransform);
+        glm::mat4 spotProj = glm::perspective(glm::radians(spotInfo.outerCone * 2), 1.0f, 0.01f, spotInfo.range);
+
+        spotViews.push_back({spotView, spotProj, spotTransform.position});
+
+        BatchRange batches = {};
+        if (spotInfo.needsUpdate)
+        {
+            GetFrustumPlanes(spotProj, spotView, planes);
+            batches = instances.Cull(planes, 6, culledDrawList, culledBatches);
+        }
+        spotBatches.push_back(batches);
+    }
+
+    std::vector<BatchRange> pointBatches;
+
+    for (PointLightRenderInfo& pointInfo : info.pointLights)
+    {
+        BatchRange batches = {};
+        if (pointInfo.needsUpdate)
+        {
+            batches = instances.CullSphere(pointInfo.transform.position, pointInfo.maxRange,
+                                           culledDrawList, culledBatches);
+        }
+        pointBatches.push_back(batches);
+    }
+
+    UploadInstances();
+
+    std::vector<NullDirLightData> dirLightData;
+
+    for (u32 i = 0; i < info.dirLights.size(); i++)
+    {
+        DirLightRenderInfo& dirInfo = info.dirLights[i];
+        Transform3D dirTransform = dirInfo.transform;
+
+        BeginPass(CASCADED_SHADOW_PASS, dirInfo.lightID);
+        SetCamera(NUM_CASCADES, &dirViews[i * NUM_CASCADES]);
+        DrawBatches(dirBatches[i]);
+        EndPass();
+
+        dirLightData.push_back({GetForwardVector(&dirTransform), (u32)dirInfo.lightID,
+                                dirInfo.diffuse, dirInfo.specular});
+    }
+
+    std::vector<NullSpotLightData> spotLightData;
+
+    for (u32 i = 0; i < info.spotLights.size(); i++)
+    {
+        SpotLightRenderInfo& spotInfo = info.spotLights[i];
+        Transform3D spotTransform = spotInfo.transform;
+        CameraData& spotCamData = spotViews[i];
+
+        if (spotInfo.needsUpdate)
+        {
+            BeginPass(SHADOW_PASS, spotInfo.lightID);
+            SetCamera(1, &spotCamData);
+            DrawBatches(spotBatches[i]);
+            EndPass();
+        }
+
+        spotLightData.push_back({spotCamData.proj * spotCamData.view, spotTransform.position, GetForwardVector(&spotTransform),
+                                 (u32)spotInfo.lightID, spotInfo.diffuse, spotInfo.specular,
+                                 cosf(glm::radians(spotInfo.innerCone)), cosf(glm::radians(spotInfo.outerCone)),
+                                 spotInfo.range});
+    }
+
+    std::vector<NullPointLightData> pointLightData;
+
+    for (u32 i = 0; i < info.pointLights.size(); i++)
+    {
+        PointLightRenderInfo& pointInfo = info.pointLights[i];
+        Transform3D pointTransform = pointInfo.transform;
+        glm::vec3 pointPos = pointTransform.position;
+
+        if (pointInfo.needsUpdate)
+        {
+            CameraData pointCamData[6];
+
+            glm::mat4 pointProj = glm::perspective(glm::radians(90.0f), 1.0f, 0.5f, pointInfo.maxRange);
+            glm::mat4 pointViews[6];
+
+            GetPointViews(&pointTransform, pointViews);
+
+            for (int face = 0; face < 6; face++)
+            {
+                pointCamData[face] = {pointViews[face], pointProj, pointPos};
+            }
+
+            BeginPass(CUBEMAP_SHADOW_PASS, pointInfo.lightID);
+            SetCamera(6, pointCamData);
+            DrawBatches(pointBatches[i]);
+            EndPass();
+        }
+
+        pointLightData.push_back({pointPos, (u32)pointInfo.lightID,
+                                  pointInfo.diffuse, pointInfo.specular,
+                                  pointInfo.constant, pointInfo.linear, pointInfo.quadratic,
+                                  pointInfo.maxRange});
+    }
+
+    CameraData mainCamData = {view, proj, cameraTransform.position};
+
+    BeginPass(DEPTH_PASS, 0);
+    SetCamera(1, &mainCamData);
+    DrawBatches(mainBatches);
+    EndPass();
+
+    BeginPass(COLOR_PASS, 0);
+    SetCamera(1, &mainCamData);
+    SetLights(dirLightData.size(), dirLightData.data(),
+              spotLightData.size(), spotLightData.data(),
+              pointLightData.size(), pointLightData.data());
+    DrawBatches(mainBatches);
+#if SKL_ENABLED_EDITOR
+    // Still ends the ImGui frame the platform layer started
+    ImGui::Render();
+#endif
+    EndPass();
+
+    lastFrameStats = frameStats;
+    frameStats = {};
+
+    frameNum++;
+    frameNum %= NUM_FRAMES;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "renderer/render_backend.h"
+
+// The null backend does all the CPU side work of a frame (instance
+// uploads, batching, light and cascade setup) and records what it
+// would have submitted into a command stream, without a device.
+// It is meant for measuring the game side cost of rendering on
+// machines without a GPU.
+
+enum NullPassType : u8
+{
+    CASCADED_SHADOW_PASS,
+    SHADOW_PASS,
+    CUBEMAP_SHADOW_PASS,
+    DEPTH_PASS,
+    COLOR_PASS
+};
+
+enum NullCommandType : u8
+{
+    BEGIN_PASS,     // a = NullPassType, b = LightID or 0
+    SET_CAMERA,     // a = first view, b = view count
+    SET_LIGHTS,     // a = dir count, b = spot count, c = point count
+    SET_MESH,       // a = MeshID, b = index count
+    DRAW_INSTANCED, // a = instance count, b = first instance
+    END_PASS
+};
+
+// One recorded command, kept small so a frame's stream stays cheap to
+// write and to walk.
+struct NullCommand
+{
+    NullCommandType type;
+    u32 a;
+    u32 b;
+    u32 c;
+};
+
+// Counters for the last finished frame. Uploads made between two
+// frames count towards the later one.
+struct NullRenderStats
+{
+    u32 passes;
+    u32 draws;
+    u32 instances;
+    u64 bytesUploaded;
+};
+
+const NullRenderStats& GetNullRenderStats();
+
+// The commands recorded by the last RenderUpdate
+const std::vector<NullCommand>& GetNullCommandStream();
@@ -46,6 +46,7 @@ struct RenderUploadMeshInfo {
     u32* idxData;
     u32 vertSize;
     u32 idxSize;
+    MeshBounds bounds;
 
     // Vulkan Specific
 
@@ -53,6 +54,10 @@ struct RenderUploadMeshInfo {
 };
 MeshID UploadMesh(RenderUploadMeshInfo& info);
 
+// Get the bounds the mesh was uploaded with, or empty bounds at the
+// origin for unknown meshes
+MeshBounds GetMeshBounds(MeshID meshID);
+
 struct RenderUploadTextureInfo {
     u32 width;
     u32 height;
@@ -92,6 +97,15 @@ struct MeshRenderInfo {
     // WGPU Specific
 };
 
+// Render instances are the renderer's persistent copy of the objects
+// to draw. Each keeps its place on the GPU until destroyed, and only
+// the instances updated since a frame was last drawn are uploaded
+// again, so instances should only be updated when their data changed.
+// Instances are drawn from their first update on.
+InstanceID AddInstance();
+void UpdateInstance(InstanceID instanceID, MeshRenderInfo& info);
+void DestroyInstance(InstanceID instanceID);
+
 struct DirLightRenderInfo {
     // Shared
     LightID lightID;
@@ -139,7 +153,6 @@ struct PointLightRenderInfo {
 struct RenderFrameInfo {
     // Shared
     Transform3D cameraTransform;
-    std::vector<MeshRenderInfo> &meshes;
 
     std::vector<DirLightRenderInfo>& dirLights;
     std::vector<SpotLightRenderInfo>& spotLights;
@@ -0,0 +1,398 @@
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+// Instances whose mesh has no bounds are never culled
+#define UNBOUNDED_RADIUS 1e30f
+#define MAX_CULL_PLANES 8
+
+// An instanced draw of one mesh over a range of a draw list
+struct DrawBatch
+{
+    MeshID mesh;
+    u32 count;
+    u32 first;
+};
+
+// The batches of one view among a frame's culled batches
+struct BatchRange
+{
+    u32 first;
+    u32 count;
+};
+
+// Backend side of the render instances. Every instance keeps its slot
+// in the object buffer for as long as it lives, so a frame only has to
+// upload the slots written since that frame's buffer was last filled.
+// The draw list orders the slots by mesh for instanced draws, and only
+// changes when instances come, go or change meshes. Views that only see
+// part of the scene get their own draw lists from Cull and CullSphere.
+struct InstanceTable
+{
+    // Indexed by InstanceID. Free slots and instances that have not
+    // been updated yet have no mesh.
+    std::vector<ObjectData> objects;
+    std::vector<MeshID> meshes;
+    // Position of each instance in its mesh's list
+    std::vector<u32> listIndices;
+    // One bit per frame in flight whose buffer lacks the slot's data
+    std::vector<u8> dirtyBits;
+    std::vector<InstanceID> freeSlots;
+
+    // The instances of each mesh, in draw list order
+    std::map<MeshID, std::vector<InstanceID>> meshInstances;
+    u32 drawCount{0};
+
+    // Slots to upload before drawing each frame in flight
+    std::vector<std::vector<InstanceID>> dirty;
+    // One bit per frame in flight whose draw list is out of date
+    u8 drawListBits{0};
+
+    // World space bounding sphere of each slot, split by coordinate so
+    // that Cull can test several at once. Padded to a multiple of 8.
+    std::vector<f32> sphereX;
+    std::vector<f32> sphereY;
+    std::vector<f32> sphereZ;
+    std::vector<f32> sphereRadius;
+    // One bit per slot, set by the last test for the slots it passed
+    std::vector<u8> visible;
+
+    // Bounding sphere of each mesh in its own space
+    std::unordered_map<MeshID, BoundingSphere> meshSpheres;
+
+    void Init(u32 frameCount)
+    {
+        dirty.resize(frameCount);
+    }
+
+    InstanceID Add()
+    {
+        if (!freeSlots.empty())
+        {
+            InstanceID id = freeSlots.back();
+            freeSlots.pop_back();
+            return id;
+        }
+
+        objects.emplace_back();
+        meshes.push_back(-1);
+        listIndices.push_back(0);
+        dirtyBits.push_back(0);
+        if (sphereX.size() < objects.size())
+        {
+            size_t padded = sphereX.size() + 8;
+            sphereX.resize(padded);
+            sphereY.resize(padded);
+            sphereZ.resize(padded);
+            sphereRadius.resize(padded);
+            visible.resize(padded / 8);
+        }
+        return (InstanceID)objects.size() - 1;
+    }
+
+    void Unlist(InstanceID id)
+    {
+        auto search = meshInstances.find(meshes[id]);
+        std::vector<InstanceID> &list = search->second;
+        InstanceID last = list.back();
+        list[listIndices[id]] = last;
+        listIndices[last] = listIndices[id];
+        list.pop_back();
+        if (list.empty())
+        {
+            meshInstances.erase(search);
+        }
+
+        meshes[id] = -1;
+        drawCount--;
+        drawListBits = (u8)((1 << dirty.size()) - 1);
+    }
+
+    void Update(InstanceID id, MeshRenderInfo &info)
+    {
+        glm::vec3 color = info.rgbColor;
+        objects[id] = {info.matrix, info.texture, glm::vec4(color.r, color.g, color.b, 1.0f)};
+
+        // The sphere grows with the largest scale of the matrix
+        auto search = meshSpheres.find(info.mesh);
+        BoundingSphere sphere = search != meshSpheres.end() ? search->second : BoundingSphere{glm::vec3(0.0f), UNBOUNDED_RADIUS};
+        glm::vec3 center = info.matrix * glm::vec4(sphere.center, 1.0f);
+        f32 scale = std::max(glm::length(glm::vec3(info.matrix[0])),
+                             std::max(glm::length(glm::vec3(info.matrix[1])), glm::length(glm::vec3(info.matrix[2]))));
+        sphereX[id] = center.x;
+        sphereY[id] = center.y;
+        sphereZ[id] = center.z;
+        sphereRadius[id] = std::min(sphere.radius * scale, UNBOUNDED_RADIUS);
+
+        for (u32 frame = 0; frame < dirty.size(); frame++)
+        {
+            if (!(dirtyBits[id] & (1 << frame)))
+            {
+                dirtyBits[id] |= 1 << frame;
+                dirty[frame].push_back(id);
+            }
+        }
+
+        if (meshes[id] != info.mesh)
+        {
+            if (meshes[id] != -1)
+            {
+                Unlist(id);
+            }
+            std::vector<InstanceID> &list = meshInstances[info.mesh];
+            listIndices[id] = list.size();
+            list.push_back(id);
+            meshes[id] = info.mesh;
+            drawCount++;
+            drawListBits = (u8)((1 << dirty.size()) - 1);
+        }
+    }
+
+    void Destroy(InstanceID id)
+    {
+        if (meshes[id] != -1)
+        {
+            Unlist(id);
+        }
+        freeSlots.push_back(id);
+    }
+
+    // Forgets the slots waiting to be uploaded for the frame, once they
+    // have been.
+    void ClearDirty(u32 frame)
+    {
+        for (InstanceID id : dirty[frame])
+        {
+            dirtyBits[id] &= ~(1 << frame);
+        }
+        dirty[frame].clear();
+    }
+
+    // Whether the frame's draw list needs writing, which it is assumed
+    // to be right after.
+    bool TakeDrawList(u32 frame)
+    {
+        bool stale = drawListBits & (1 << frame);
+        drawListBits &= ~(1 << frame);
+        return stale;
+    }
+
+    // Writes the slot of every instance with a mesh, grouped by mesh.
+    void WriteDrawList(u32 *out)
+    {
+        for (auto &[mesh, list] : meshInstances)
+        {
+            memcpy(out, list.data(), sizeof(InstanceID) * list.size());
+            out += list.size();
+        }
+    }
+
+    // Sets the visible bit of the slots whose bounding spheres are at
+    // least partly inside all of the given planes, which face inwards.
+    // Tests 8 slots at a time.
+    void TestPlanes(const glm::vec4 *planes, u32 planeCount)
+    {
+        // Writing the visibility bytes could alias anything, so all the
+        // inputs are read into locals first.
+        const f32 *xs = sphereX.data();
+        const f32 *ys = sphereY.data();
+        const f32 *zs = sphereZ.data();
+        const f32 *radii = sphereRadius.data();
+        u8 *bits = visible.data();
+        u32 groupCount = (u32)visible.size();
+        planeCount = std::min(planeCount, (u32)MAX_CULL_PLANES);
+
+#if defined(__AVX__)
+        __m256 planeX[MAX_CULL_PLANES], planeY[MAX_CULL_PLANES], planeZ[MAX_CULL_PLANES], planeW[MAX_CULL_PLANES];
+        for (u32 p = 0; p < planeCount; p++)
+        {
+            planeX[p] = _mm256_set1_ps(planes[p].x);
+            planeY[p] = _mm256_set1_ps(planes[p].y);
+            planeZ[p] = _mm256_set1_ps(planes[p].z);
+            planeW[p] = _mm256_set1_ps(planes[p].w);
+        }
+
+        for (u32 group = 0; group < groupCount; group++)
+        {
+            u32 first = group * 8;
+            __m256 x = _mm256_loadu_ps(xs + first);
+            __m256 y = _mm256_loadu_ps(ys + first);
+            __m256 z = _mm256_loadu_ps(zs + first);
+            __m256 r = _mm256_loadu_ps(radii + first);
+            __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            for (u32 p = 0; p < planeCount; p++)
+            {
+                __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, planeX[p]), _mm256_mul_ps(y, planeY[p])),
+                                         _mm256_add_ps(_mm256_mul_ps(z, planeZ[p]), _mm256_add_ps(r, planeW[p])));
+                inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_GE_OQ));
+            }
+            bits[group] = (u8)_mm256_movemask_ps(inside);
+        }
+#elif defined(__SSE2__) || defined(_M_X64)
+        __m128 planeX[MAX_CULL_PLANES], planeY[MAX_CULL_PLANES], planeZ[MAX_CULL_PLANES], planeW[MAX_CULL_PLANES];
+        for (u32 p = 0; p < planeCount; p++)
+        {
+            planeX[p] = _mm_set1_ps(planes[p].x);
+            planeY[p] = _mm_set1_ps(planes[p].y);
+            planeZ[p] = _mm_set1_ps(planes[p].z);
+            planeW[p] = _mm_set1_ps(planes[p].w);
+        }
+
+        for (u32 group = 0; group < groupCount; group++)
+        {
+            u32 groupBits = 0;
+            for (u32 half = 0; half < 8; half += 4)
+            {
+                u32 first = group * 8 + half;
+                __m128 x = _mm_loadu_ps(xs + first);
+                __m128 y = _mm_loadu_ps(ys + first);
+                __m128 z = _mm_loadu_ps(zs + first);
+                __m128 r = _mm_loadu_ps(radii + first);
+                __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+                for (u32 p = 0; p < planeCount; p++)
+                {
+                    __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, planeX[p]), _mm_mul_ps(y, planeY[p])),
+                                          _mm_add_ps(_mm_mul_ps(z, planeZ[p]), _mm_add_ps(r, planeW[p])));
+                    inside = _mm_and_ps(inside, _mm_cmpge_ps(d, _mm_setzero_ps()));
+                }
+                groupBits |= _mm_movemask_ps(inside) << half;
+            }
+            bits[group] = (u8)groupBits;
+        }
+#else
+        glm::vec4 localPlanes[MAX_CULL_PLANES];
+        std::copy(planes, planes + planeCount, localPlanes);
+        for (u32 group = 0; group < groupCount; group++)
+        {
+            u32 groupBits = 0;
+            for (u32 i = 0; i < 8; i++)
+            {
+                u32 slot = group * 8 + i;
+                glm::vec3 center(xs[slot], ys[slot], zs[slot]);
+                bool inside = true;
+                for (u32 p = 0; p < planeCount; p++)
+                {
+                    inside &= glm::dot(glm::vec3(localPlanes[p]), center) + localPlanes[p].w + radii[slot] >= 0.0f;
+                }
+                groupBits |= (u32)inside << i;
+            }
+            bits[group] = (u8)groupBits;
+        }
+#endif
+    }
+
+    // Sets the visible bit of the slots whose bounding spheres touch the
+    // given sphere. Tests 8 slots at a time.
+    void TestSphere(glm::vec3 center, f32 radius)
+    {
+        const f32 *xs = sphereX.data();
+        const f32 *ys = sphereY.data();
+        const f32 *zs = sphereZ.data();
+        const f32 *radii = sphereRadius.data();
+        u8 *bits = visible.data();
+        u32 groupCount = (u32)visible.size();
+
+#if defined(__AVX__)
+        __m256 cx = _mm256_set1_ps(center.x);
+        __m256 cy = _mm256_set1_ps(center.y);
+        __m256 cz = _mm256_set1_ps(center.z);
+        __m256 cr = _mm256_set1_ps(radius);
+        for (u32 group = 0; group < groupCount; group++)
+        {
+            u32 first = group * 8;
+            __m256 x = _mm256_sub_ps(_mm256_loadu_ps(xs + first), cx);
+            __m256 y = _mm256_sub_ps(_mm256_loadu_ps(ys + first), cy);
+            __m256 z = _mm256_sub_ps(_mm256_loadu_ps(zs + first), cz);
+            __m256 reach = _mm256_add_ps(_mm256_loadu_ps(radii + first), cr);
+            __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z));
+            bits[group] = (u8)_mm256_movemask_ps(_mm256_cmp_ps(d, _mm256_mul_ps(reach, reach), _CMP_LE_OQ));
+        }
+#elif defined(__SSE2__) || defined(_M_X64)
+        __m128 cx = _mm_set1_ps(center.x);
+        __m128 cy = _mm_set1_ps(center.y);
+        __m128 cz = _mm_set1_ps(center.z);
+        __m128 cr = _mm_set1_ps(radius);
+        for (u32 group = 0; group < groupCount; group++)
+        {
+            u32 groupBits = 0;
+            for (u32 half = 0; half < 8; half += 4)
+            {
+                u32 first = group * 8 + half;
+                __m128 x = _mm_sub_ps(_mm_loadu_ps(xs + first), cx);
+                __m128 y = _mm_sub_ps(_mm_loadu_ps(ys + first), cy);
+                __m128 z = _mm_sub_ps(_mm_loadu_ps(zs + first), cz);
+                __m128 reach = _mm_add_ps(_mm_loadu_ps(radii + first), cr);
+                __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+                groupBits |= _mm_movemask_ps(_mm_cmple_ps(d, _mm_mul_ps(reach, reach))) << half;
+            }
+            bits[group] = (u8)groupBits;
+        }
+#else
+        for (u32 group = 0; group < groupCount; group++)
+        {
+            u32 groupBits = 0;
+            for (u32 i = 0; i < 8; i++)
+            {
+                u32 slot = group * 8 + i;
+                glm::vec3 offset = glm::vec3(xs[slot], ys[slot], zs[slot]) - center;
+                f32 reach = radii[slot] + radius;
+                groupBits |= (u32)(glm::dot(offset, offset) <= reach * reach) << i;
+            }
+            bits[group] = (u8)groupBits;
+        }
+#endif
+    }
+
+    // Appends the visible instances to the draw list, grouped by mesh
+    // like the full one, and their batches to the given ones. Gets the
+    // appended batches.
+    BatchRange PackVisible(std::vector<u32> &drawList, std::vector<DrawBatch> &batches)
+    {
+        const u8 *bits = visible.data();
+        BatchRange range = {(u32)batches.size(), 0};
+
+        // Whether an instance is in view is hard to predict, so every
+        // instance is written and only the visible ones are kept.
+        u32 count = drawList.size();
+        drawList.resize(count + drawCount);
+        for (auto &[mesh, list] : meshInstances)
+        {
+            u32 first = count;
+            for (InstanceID id : list)
+            {
+                drawList[count] = id;
+                count += (bits[id >> 3] >> (id & 7)) & 1;
+            }
+            if (count > first)
+            {
+                batches.push_back({mesh, count - first, first});
+            }
+        }
+        drawList.resize(count);
+
+        range.count = batches.size() - range.first;
+        return range;
+    }
+
+    BatchRange Cull(const glm::vec4 *planes, u32 planeCount,
+                    std::vector<u32> &drawList, std::vector<DrawBatch> &batches)
+    {
+        TestPlanes(planes, planeCount);
+        return PackVisible(drawList, batches);
+    }
+
+    BatchRange CullSphere(glm::vec3 center, f32 radius,
+                          std::vector<u32> &drawList, std::vector<DrawBatch> &batches)
+    {
+        TestSphere(center, radius);
+        return PackVisible(drawList, batches);
+    }
+};
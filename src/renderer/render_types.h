@@ -11,6 +11,7 @@
 typedef int32_t MeshID;
 typedef int32_t TextureID;
 typedef int32_t LightID;
+typedef int32_t InstanceID;
 
 // Represents a vertex of a mesh (CPU->GPU)
 struct Vertex
@@ -27,6 +28,20 @@ struct AABB
     glm::vec3 max;
 };
 
+struct BoundingSphere
+{
+    glm::vec3 center;
+    f32 radius;
+};
+
+// Bounds of a mesh's vertices in its own space. The sphere is centered
+// on the box.
+struct MeshBounds
+{
+    AABB aabb;
+    BoundingSphere sphere;
+};
+
 // Represents the transformation data of the objects in the scene (CPU->GPU)
 struct ObjectData
 {
@@ -31,6 +31,7 @@
 #include "renderer/render_backend.h"
 #include "renderer/vk_backend/vk_render_types.h"
 #include "renderer/vk_backend/vk_render_utils.cpp"
+#include "renderer/render_instances.cpp"
 
 #include <vulkan/VkBootstrap.h>
 
@@ -101,6 +102,11 @@ TextureID currentTexID;
 std::unordered_map<TextureID,Texture> textures;
 LightID currentLightID;
 std::unordered_map<LightID,LightEntry> lights;
+InstanceTable instances;
+// The instances each view sees this frame, the main camera's and then
+// each shadow pass's, drawn from after the full draw list
+std::vector<u32> culledDrawList;
+std::vector<DrawBatch> culledBatches;
 
 VkSampler shadowSampler;
 VkSampler textureSampler;
@@ -169,7 +175,17 @@ MeshID UploadMesh(u32 vertCount, Vertex* vertices, u32 indexCount, u32* indices)
 
 MeshID UploadMesh(RenderUploadMeshInfo& info)
 {
-    return UploadMesh(info.vertSize, info.vertData, info.idxSize, info.idxData);
+    MeshID id = UploadMesh(info.vertSize, info.vertData, info.idxSize, info.idxData);
+    meshes[id].bounds = info.bounds;
+    instances.meshSpheres[id] = info.bounds.sphere;
+
+    return id;
+}
+
+MeshBounds GetMeshBounds(MeshID meshID)
+{
+    auto search = meshes.find(meshID);
+    return search != meshes.end() ? search->second.bounds : MeshBounds{};
 }
 
 void DestroyMesh(RenderDestroyMeshInfo& info)
@@ -178,6 +194,17 @@ void DestroyMesh(RenderDestroyMeshInfo& info)
     DestroyBuffer(allocator, mesh.indexBuffer);
     DestroyBuffer(allocator, mesh.vertBuffer);
     meshes.erase(info.meshID);
+    instances.meshSpheres.erase(info.meshID);
+}
+
+// Creates a buffer the CPU writes to every frame and shaders read through its address
+AllocatedBuffer CreateFrameBuffer(size_t size)
+{
+    return CreateBuffer(device, allocator, size,
+                        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
+                        VMA_ALLOCATION_CREATE_MAPPED_BIT
+                        | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
+                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
 }
 
 u32 CreateCameraBuffer(u32 viewCount)
@@ -482,6 +509,21 @@ LightID AddPointLight()
     return currentLightID;
 }
 
+InstanceID AddInstance()
+{
+    return instances.Add();
+}
+
+void UpdateInstance(InstanceID instanceID, MeshRenderInfo& info)
+{
+    instances.Update(instanceID, info);
+}
+
+void DestroyInstance(InstanceID instanceID)
+{
+    instances.Destroy(instanceID);
+}
+
 void DestroyDirLight(LightID lightID)
 {
 
@@ -752,12 +794,10 @@ void InitPipelines(RenderPipelineInitInfo& info)
     // Create object and light buffers
     for (int i = 0; i < NUM_FRAMES; i++)
     {
-        frames[i].objectBuffer = CreateBuffer(device, allocator,
-                                              sizeof(ObjectData) * 4096,
-                                              VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-                                              VMA_ALLOCATION_CREATE_MAPPED_BIT
-                                              | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
-                                              VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+        frames[i].objectCapacity = 4096;
+        frames[i].objectBuffer = CreateFrameBuffer(sizeof(ObjectData) * frames[i].objectCapacity);
+        frames[i].drawListCapacity = 4096;
+        frames[i].drawListBuffer = CreateFrameBuffer(sizeof(InstanceID) * frames[i].drawListCapacity);
 
         frames[i].dirLightBuffer = CreateBuffer(device, allocator,
                                                 sizeof(VkDirLightData) * 4,
@@ -785,6 +825,8 @@ void InitPipelines(RenderPipelineInitInfo& info)
                                                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
     }
 
+    instances.Init(NUM_FRAMES);
+
     mainCamIndex = CreateCameraBuffer(1);
 
     // Create shader stages
@@ -1514,11 +1556,48 @@ void SetLights(glm::vec3 ambientLight,
                        sizeof(VkDeviceAddress) + sizeof(VertPushConstants), sizeof(FragPushConstants), &pushConstants);
 }
 
-// Send the matrices of the models to render (Must be called between InitFrame and EndFrame)
-void SendObjectData(std::vector<ObjectData>& objects)
+// Brings this frame's object buffer and draw list up to date with the
+// render instances, only copying the slots that changed since this
+// frame was last drawn, and appends the culled draw lists. The
+// buffers are regrown and refilled when the instances outgrow them.
+// (Must be called between InitFrame and EndFrame)
+void UploadInstances()
 {
-    void* objectData = frames[frameNum].objectBuffer.allocation->GetMappedData();
-    memcpy(objectData, objects.data(), sizeof(ObjectData) * objects.size());
+    FrameData& frame = frames[frameNum];
+
+    ObjectData* objectData = (ObjectData*)frame.objectBuffer.allocation->GetMappedData();
+    if (frame.objectCapacity < instances.objects.size())
+    {
+        DestroyBuffer(allocator, frame.objectBuffer);
+        frame.objectCapacity = std::max(frame.objectCapacity * 2, (u32)instances.objects.size());
+        frame.objectBuffer = CreateFrameBuffer(sizeof(ObjectData) * frame.objectCapacity);
+        objectData = (ObjectData*)frame.objectBuffer.allocation->GetMappedData();
+        memcpy(objectData, instances.objects.data(), sizeof(ObjectData) * instances.objects.size());
+    }
+    else
+    {
+        for (InstanceID id : instances.dirty[frameNum])
+        {
+            objectData[id] = instances.objects[id];
+        }
+    }
+    instances.ClearDirty(frameNum);
+
+    bool writeDrawList = instances.TakeDrawList(frameNum);
+    u32 drawListSize = instances.drawCount + culledDrawList.size();
+    if (frame.drawListCapacity < drawListSize)
+    {
+        DestroyBuffer(allocator, frame.drawListBuffer);
+        frame.drawListCapacity = std::max(frame.drawListCapacity * 2, drawListSize);
+        frame.drawListBuffer = CreateFrameBuffer(sizeof(InstanceID) * frame.drawListCapacity);
+        writeDrawList = true;
+    }
+    u32* drawList = (u32*)frame.drawListBuffer.allocation->GetMappedData();
+    if (writeDrawList)
+    {
+        instances.WriteDrawList(drawList);
+    }
+    memcpy(drawList + instances.drawCount, culledDrawList.data(), sizeof(u32) * culledDrawList.size());
 }
 
 // Set the mesh currently being rendered (Must be called between InitFrame and EndFrame)
@@ -1528,7 +1607,8 @@ void SetMesh(MeshID meshIndex)
 
     // Send addresses to camera, object, and vertex buffers as push constants
     VkCommandBuffer& cmd = frames[frameNum].commandBuffer;
-    VertPushConstants pushConstants = {frames[frameNum].objectBuffer.address, mesh->vertBuffer.address};
+    VertPushConstants pushConstants = {frames[frameNum].objectBuffer.address, mesh->vertBuffer.address,
+                                       frames[frameNum].drawListBuffer.address};
     vkCmdPushConstants(cmd, *currentLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,
                        sizeof(VkDeviceAddress), sizeof(VertPushConstants), &pushConstants);
     // Bind the index buffer
@@ -1543,6 +1623,17 @@ void DrawObjects(int count, int startIndex)
     vkCmdDrawIndexed(frames[frameNum].commandBuffer, currentIndexCount, count, 0, 0, startIndex);
 }
 
+// Draw a range of this frame's culled batches (Must be called between InitFrame and EndFrame)
+void DrawBatches(BatchRange range)
+{
+    for (u32 i = range.first; i < range.first + range.count; i++)
+    {
+        DrawBatch& batch = culledBatches[i];
+        SetMesh(batch.mesh);
+        DrawObjects(batch.count, instances.drawCount + batch.first);
+    }
+}
+
 // End the frame and present it to the screen
 void EndFrame()
 {
@@ -1611,56 +1702,30 @@ void RenderUpdate(RenderFrameInfo& info)
         return;
     }
 
-    // 1. Gather counts of each unique mesh pointer.
-    std::map<MeshID, u32> meshCounts;
-    for (MeshRenderInfo meshInfo : info.meshes)
-    {
-        ++meshCounts[meshInfo.mesh];
-    }
-
-    // 2. Create, with fixed size, the list of Mat4s, by adding up all of the counts.
-    // 3. Get pointers to the start of each segment of unique mesh pointer.
-    u32 totalCount = 0;
-    std::unordered_map<MeshID, u32> offsets;
-    for (std::pair<MeshID, u32> pair: meshCounts)
-    {
-        offsets[pair.first] = totalCount;
-        totalCount += pair.second;
-    }
-
-    std::vector<ObjectData> objects(totalCount);
-
-    // 4. Iterate through scene view once more and fill in the fixed size array.
-    for (MeshRenderInfo meshInfo : info.meshes)
-    {
-        glm::mat4 model = meshInfo.matrix;
-        MeshID mesh = meshInfo.mesh;
-        TextureID tex = meshInfo.texture;
-        glm::vec3 color = meshInfo.rgbColor;
-
-        objects[offsets[mesh]++] = {model, tex, glm::vec4(color.r, color.g, color.b, 1.0f)};
-    }
-
-    SendObjectData(objects);
-
     Transform3D cameraTransform = info.cameraTransform;
     glm::mat4 view = GetViewMatrix(&cameraTransform);
     f32 aspect = (f32)swapExtent.width / (f32)swapExtent.height;
 
     glm::mat4 proj = glm::perspective(glm::radians(info.cameraFov), aspect, info.cameraNear, info.cameraFar);
 
+    // Every view is culled before any pass is recorded, so that all of
+    // the frame's draw lists are uploaded together
+    culledDrawList.clear();
+    culledBatches.clear();
+
+    glm::vec4 planes[6];
+    GetFrustumPlanes(proj, view, planes);
+    BatchRange mainBatches = instances.Cull(planes, 6, culledDrawList, culledBatches);
+
     // Calculate cascaded shadow views
 
-    CameraData dirViews[NUM_CASCADES];
+    std::vector<CameraData> dirViews;
+    std::vector<BatchRange> dirBatches;
 
     f32 subFrustumSize = (info.cameraFar - info.cameraNear) / NUM_CASCADES;
 
-    std::vector<VkDirLightData> dirLightData;
-
     std::vector<LightCascade> cascades;
 
-    u32 startIndex;
-
     for (DirLightRenderInfo dirInfo : info.dirLights)
     {
         f32 currentNear = info.cameraNear;
@@ -1668,6 +1733,10 @@ void RenderUpdate(RenderFrameInfo& info)
         Transform3D dirTransform = dirInfo.transform;
         glm::mat4 dirView = GetViewMatrix(&dirTransform);
 
+        // Light space box around all the cascades
+        glm::vec3 boxMin(std::numeric_limits<f32>::max());
+        glm::vec3 boxMax(std::numeric_limits<f32>::lowest());
+
         for (int i = 0; i < NUM_CASCADES; i++)
         {
             glm::mat4 subProj = glm::perspective(glm::radians(info.cameraFov), aspect,
@@ -1696,27 +1765,74 @@ void RenderUpdate(RenderFrameInfo& info)
 
             glm::mat4 dirProj = glm::ortho(minX, maxX, minY, maxY, minZ, maxZ);
 
-            dirViews[i] = {dirView, dirProj, {}};
+            dirViews.push_back({dirView, dirProj, {}});
 
             cascades.push_back({dirProj * dirView, currentNear});
+
+            boxMin = glm::min(boxMin, glm::vec3(minX, minY, minZ));
+            boxMax = glm::max(boxMax, glm::vec3(maxX, maxY, maxZ));
+        }
+
+        // The cascades are drawn together, so they share one list. Depth
+        // is clamped in shadow passes, so casters between the light and
+        // the box still shadow it, and its near side is left open.
+        glm::mat4 boxProj = glm::ortho(boxMin.x, boxMax.x, boxMin.y, boxMax.y, boxMin.z, boxMax.z);
+        GetFrustumPlanes(boxProj, dirView, planes);
+        planes[4] = planes[5];
+        dirBatches.push_back(instances.Cull(planes, 5, culledDrawList, culledBatches));
+    }
+
+    std::vector<CameraData> spotViews;
+    std::vector<BatchRange> spotBatches;
+
+    for (SpotLightRenderInfo spotInfo : info.spotLights)
+    {
+        Transform3D spotTransform = spotInfo.transform;
+        glm::mat4 spotView = GetViewMatrix(&spotTransform);
+        glm::mat4 spotProj = glm::perspective(glm::radians(spotInfo.outerCone * 2), 1.0f, 0.01f, spotInfo.range);
+
+        spotViews.push_back({spotView, spotProj, spotTransform.position});
+
+        BatchRange batches = {};
+        if (spotInfo.needsUpdate)
+        {
+            GetFrustumPlanes(spotProj, spotView, planes);
+            batches = instances.Cull(planes, 6, culledDrawList, culledBatches);
         }
+        spotBatches.push_back(batches);
+    }
 
-        glm::vec3 lightDir = GetForwardVector(&dirTransform);
+    std::vector<BatchRange> pointBatches;
 
+    for (PointLightRenderInfo pointInfo : info.pointLights)
+    {
+        // The faces are drawn together and together see everything in
+        // range of the light
+        BatchRange batches = {};
+        if (pointInfo.needsUpdate)
+        {
+            batches = instances.CullSphere(pointInfo.transform.position, pointInfo.maxRange,
+                                           culledDrawList, culledBatches);
+        }
+        pointBatches.push_back(batches);
+    }
+
+    UploadInstances();
+
+    std::vector<VkDirLightData> dirLightData;
+
+    for (u32 i = 0; i < info.dirLights.size(); i++)
+    {
+        DirLightRenderInfo& dirInfo = info.dirLights[i];
+        Transform3D dirTransform = dirInfo.transform;
         LightEntry lightEntry = lights[dirInfo.lightID];
 
         BeginCascadedPass(lightEntry.shadowMap, CullMode::BACK);
 
         SetCamera(lightEntry.cameraIndex);
-        UpdateCamera(NUM_CASCADES, dirViews);
+        UpdateCamera(NUM_CASCADES, &dirViews[i * NUM_CASCADES]);
 
-        startIndex = 0;
-        for (std::pair<MeshID, u32> pair: meshCounts)
-        {
-            SetMesh(pair.first);
-            DrawObjects(pair.second, startIndex);
-            startIndex += pair.second;
-        }
+        DrawBatches(dirBatches[i]);
         EndPass();
 
         dirLightData.push_back({GetForwardVector(&dirTransform),
@@ -1727,34 +1843,26 @@ void RenderUpdate(RenderFrameInfo& info)
 
     std::vector<VkSpotLightData> spotLightData;
 
-    for (SpotLightRenderInfo spotInfo : info.spotLights)
+    for (u32 i = 0; i < info.spotLights.size(); i++)
     {
+        SpotLightRenderInfo& spotInfo = info.spotLights[i];
         Transform3D spotTransform = spotInfo.transform;
-        glm::mat4 spotView = GetViewMatrix(&spotTransform);
-        glm::mat4 spotProj = glm::perspective(glm::radians(spotInfo.outerCone * 2), 1.0f, 0.01f, spotInfo.range);
+        CameraData& spotCamData = spotViews[i];
         LightEntry lightEntry = lights[spotInfo.lightID];
 
         if (spotInfo.needsUpdate)
         {
-            CameraData spotCamData = {spotView, spotProj, spotTransform.position};
-
             BeginShadowPass(lightEntry.shadowMap, CullMode::BACK);
 
             SetCamera(lightEntry.cameraIndex);
             UpdateCamera(1, &spotCamData);
 
-            startIndex = 0;
-            for (std::pair<MeshID, u32> pair: meshCounts)
-            {
-                SetMesh(pair.first);
-                DrawObjects(pair.second, startIndex);
-                startIndex += pair.second;
-            }
+            DrawBatches(spotBatches[i]);
             EndPass();
         }
 
 
-        spotLightData.push_back({spotProj * spotView, spotTransform.position, GetForwardVector(&spotTransform),
+        spotLightData.push_back({spotCamData.proj * spotCamData.view, spotTransform.position, GetForwardVector(&spotTransform),
                                  lightEntry.shadowMap.descriptorIndex, spotInfo.diffuse, spotInfo.specular,
                                  cosf(glm::radians(spotInfo.innerCone)), cosf(glm::radians(spotInfo.outerCone)),
                                  spotInfo.range});
@@ -1762,8 +1870,9 @@ void RenderUpdate(RenderFrameInfo& info)
 
     std::vector<VkPointLightData> pointLightData;
 
-    for (PointLightRenderInfo pointInfo : info.pointLights)
+    for (u32 i = 0; i < info.pointLights.size(); i++)
     {
+        PointLightRenderInfo& pointInfo = info.pointLights[i];
         Transform3D pointTransform = pointInfo.transform;
         glm::vec3 pointPos = pointTransform.position;
         LightEntry lightEntry = lights[pointInfo.lightID];
@@ -1777,9 +1886,9 @@ void RenderUpdate(RenderFrameInfo& info)
 
             GetPointViews(&pointTransform, pointViews);
 
-            for (int i = 0; i < 6; i++)
+            for (int face = 0; face < 6; face++)
             {
-                pointCamData[i] = {pointViews[i], pointProj, pointPos};
+                pointCamData[face] = {pointViews[face], pointProj, pointPos};
             }
 
             BeginCubemapShadowPass(lightEntry.shadowMap, CullMode::BACK);
@@ -1789,13 +1898,7 @@ void RenderUpdate(RenderFrameInfo& info)
 
             SetCubemapInfo(pointPos, pointInfo.maxRange);
 
-            startIndex = 0;
-            for (std::pair<MeshID, u32> pair: meshCounts)
-            {
-                SetMesh(pair.first);
-                DrawObjects(pair.second, startIndex);
-                startIndex += pair.second;
-            }
+            DrawBatches(pointBatches[i]);
             EndPass();
         }
 
@@ -1812,13 +1915,7 @@ void RenderUpdate(RenderFrameInfo& info)
     CameraData mainCamData = {view, proj, cameraTransform.position};
     UpdateCamera(1, &mainCamData);
 
-    startIndex = 0;
-    for (std::pair<MeshID, u32> pair: meshCounts)
-    {
-        SetMesh(pair.first);
-        DrawObjects(pair.second, startIndex);
-        startIndex += pair.second;
-    }
+    DrawBatches(mainBatches);
     EndPass();
 
     BeginColorPass(CullMode::BACK);
@@ -1828,13 +1925,7 @@ void RenderUpdate(RenderFrameInfo& info)
               spotLightData.size(), spotLightData.data(),
               pointLightData.size(), pointLightData.data());
 
-    startIndex = 0;
-    for (std::pair<MeshID, u32> pair: meshCounts)
-    {
-        SetMesh(pair.first);
-        DrawObjects(pair.second, startIndex);
-        startIndex += pair.second;
-    }
+    DrawBatches(mainBatches);
 #if SKL_ENABLED_EDITOR
     DrawImGui();
 #endif
@@ -22,6 +22,7 @@ struct Mesh
     AllocatedBuffer vertBuffer;
 
     u32 indexCount;
+    MeshBounds bounds;
 };
 
 // Represents a texture stored on the GPU
@@ -38,6 +39,7 @@ struct VertPushConstants
 {
     VkDeviceAddress objectAddress;
     VkDeviceAddress vertexAddress;
+    VkDeviceAddress drawListAddress;
 };
 
 struct VkDirLightData
@@ -110,7 +112,11 @@ struct FrameData
     VkFence renderFence;
 
     std::vector<AllocatedBuffer> cameraBuffers;
+    // Render instance data by slot, and the slots in draw order
     AllocatedBuffer objectBuffer;
+    AllocatedBuffer drawListBuffer;
+    u32 objectCapacity;
+    u32 drawListCapacity;
     AllocatedBuffer dirLightBuffer;
     AllocatedBuffer dirCascadeBuffer;
     AllocatedBuffer spotLightBuffer;
@@ -22,13 +22,29 @@ void InitPipelines(RenderPipelineInitInfo& desc) {
 }
 
 MeshID UploadMesh(RenderUploadMeshInfo& desc) {
-    return wgpuRenderer.UploadMesh(desc.vertSize, desc.vertData, desc.idxSize, desc.idxData);
+    return wgpuRenderer.UploadMesh(desc.vertSize, desc.vertData, desc.idxSize, desc.idxData, desc.bounds);
+}
+
+MeshBounds GetMeshBounds(MeshID meshID) {
+    return wgpuRenderer.GetMeshBounds(meshID);
 }
 
 void DestroyMesh(RenderDestroyMeshInfo& desc) {
     wgpuRenderer.DestroyMesh(desc.meshID);
 }
 
+InstanceID AddInstance() {
+    return wgpuRenderer.AddInstance();
+}
+
+void UpdateInstance(InstanceID instanceID, MeshRenderInfo& info) {
+    wgpuRenderer.UpdateInstance(instanceID, info);
+}
+
+void DestroyInstance(InstanceID instanceID) {
+    wgpuRenderer.DestroyInstance(instanceID);
+}
+
 // This compiles information from scene to be plugged into renderer
 void RenderUpdate(RenderFrameInfo& state) {
     wgpuRenderer.RenderUpdate(state);
@@ -28,6 +28,12 @@ struct WGPUBackendMeshIdx {
     {}
 };
 
+// Represents a single instance within the shaders' object store
+struct WGPUBackendObjectData {
+    glm::mat4x4 m_transform;
+    glm::vec4 m_color;
+};
+
 // Simply combines a single texture and texture view
 // Does not handle the release of the textures
 struct WGPUBackendTexture {
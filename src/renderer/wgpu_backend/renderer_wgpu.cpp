@@ -1,7 +1,7 @@
 #include "renderer/wgpu_backend/renderer_wgpu.h"
 #include "webgpu/sdl3webgpu-main/sdl3webgpu.h"
 
-#include "skl_logger.h"
+#include "meta_definitions.h"
 
 #include "math/skl_math_utils.h"
 
@@ -230,13 +230,46 @@ void WGPURenderBackend::EndFrame() {
   #endif
 }
 
-void WGPURenderBackend::DrawObjects(std::map<u32, u32>& meshCounts) {
+void WGPURenderBackend::UploadInstances() {
+  u32 slotCount = m_instances.objects.size();
+  if (slotCount > m_maxObjArraySize && !m_instanceOverflowLogged) {
+    LOG("WebGPU instance buffer holds " << m_maxObjArraySize << " instances but " << slotCount << " exist, the rest are not drawn");
+    m_instanceOverflowLogged = true;
+  }
+
+  // Only slots written since the last frame are sent, in the shaders' layout
+  for (InstanceID id : m_instances.dirty[0])
+  {
+    if ((u32)id >= m_maxObjArraySize) {
+      continue;
+    }
+    ObjectData& object = m_instances.objects[id];
+    WGPUBackendObjectData objData { object.model, object.color };
+    wgpuQueueWriteBuffer(m_wgpuQueue, m_instanceDatBuffer, sizeof(WGPUBackendObjectData) * id, &objData, sizeof(WGPUBackendObjectData));
+  }
+  m_instances.ClearDirty(0);
+
+  if (m_instances.TakeDrawList(0)) {
+    m_drawList.resize(m_instances.drawCount);
+    m_instances.WriteDrawList(m_drawList.data());
+    u32 drawCount = std::min(m_instances.drawCount, m_maxObjArraySize);
+    if (drawCount > 0) {
+      wgpuQueueWriteBuffer(m_wgpuQueue, m_drawListBuffer, 0, m_drawList.data(), sizeof(u32) * drawCount);
+    }
+  }
+}
+
+void WGPURenderBackend::DrawInstances() {
   u32 startIndex = 0;
-  for (std::pair<MeshID, u32> pair : meshCounts)
+  for (auto& [mesh, list] : m_instances.meshInstances)
   {
-    WGPUBackendMeshIdx& gotMesh = m_meshStore[pair.first];
-    wgpuRenderPassEncoderDrawIndexed(m_renderPassEncoder, gotMesh.m_indexCount, pair.second, gotMesh.m_baseIndex, gotMesh.m_baseVertex, startIndex);
-    startIndex += pair.second;
+    if (startIndex >= m_maxObjArraySize) {
+      break;
+    }
+    u32 count = std::min((u32)list.size(), m_maxObjArraySize - startIndex);
+    WGPUBackendMeshIdx& gotMesh = m_meshStore[mesh];
+    wgpuRenderPassEncoderDrawIndexed(m_renderPassEncoder, gotMesh.m_indexCount, count, gotMesh.m_baseIndex, gotMesh.m_baseVertex, startIndex);
+    startIndex += list.size();
   }
 }
 
@@ -413,6 +446,8 @@ WGPURenderBackend::~WGPURenderBackend() {
 }
 
 void WGPURenderBackend::InitRenderer(SDL_Window *window, u32 startWidth, u32 startHeight) {
+  m_instances.Init(1);
+
   // Creates instance
   WGPUInstanceDescriptor instanceDescriptor { 
     .nextInChain = nullptr
@@ -763,11 +798,21 @@ void WGPURenderBackend::InitPipelines()
   objDatBind.binding = 1;
   objDatBind.visibility = WGPUShaderStage_Vertex;
   objDatBind.buffer.type = WGPUBufferBindingType_ReadOnlyStorage;
-  objDatBind.buffer.minBindingSize = sizeof(glm::mat4x4) + (sizeof(glm::vec4));
+  objDatBind.buffer.minBindingSize = sizeof(WGPUBackendObjectData);
 
   bindEntities.push_back( objDatBind );
   depthBindEntities.push_back( objDatBind );
 
+  // Maps each drawn instance to its slot within the object store
+  WGPUBindGroupLayoutEntry drawListBind = DefaultBindLayoutEntry();
+  drawListBind.binding = 4;
+  drawListBind.visibility = WGPUShaderStage_Vertex;
+  drawListBind.buffer.type = WGPUBufferBindingType_ReadOnlyStorage;
+  drawListBind.buffer.minBindingSize = sizeof(u32);
+
+  bindEntities.push_back( drawListBind );
+  depthBindEntities.push_back( drawListBind );
+
   WGPUBindGroupLayoutEntry lightSpaceStoreBind = DefaultBindLayoutEntry();
   lightSpaceStoreBind.binding = 2;
   lightSpaceStoreBind.visibility = WGPUShaderStage_Vertex;
@@ -888,12 +933,22 @@ void WGPURenderBackend::InitPipelines()
     .nextInChain = nullptr,
     .label = wgpuStr("Instance Buffer Description"),
     .usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Storage,
-    .size = sizeof(ObjectData) * m_maxObjArraySize,
+    .size = sizeof(WGPUBackendObjectData) * m_maxObjArraySize,
     .mappedAtCreation = false,
   };
 
   m_instanceDatBuffer = wgpuDeviceCreateBuffer(m_wgpuDevice, &instanceBufferDesc);
 
+  WGPUBufferDescriptor drawListBufferDesc {
+    .nextInChain = nullptr,
+    .label = wgpuStr("Draw List Buffer Description"),
+    .usage = WGPUBufferUsage_CopyDst | WGPUBufferUsage_Storage,
+    .size = sizeof(u32) * m_maxObjArraySize,
+    .mappedAtCreation = false,
+  };
+
+  m_drawListBuffer = wgpuDeviceCreateBuffer(m_wgpuDevice, &drawListBufferDesc);
+
   WGPUBufferDescriptor lightSpacesBufferDesc {
     .nextInChain = nullptr,
     .label = wgpuStr("Light Space Buffer Description"),
@@ -933,11 +988,21 @@ void WGPURenderBackend::InitPipelines()
     .binding = 1,
     .buffer = m_instanceDatBuffer,
     .offset = 0,
-    .size = sizeof(ObjectData) * m_maxObjArraySize,
+    .size = sizeof(WGPUBackendObjectData) * m_maxObjArraySize,
   };
   bindGroupEntries.push_back(objDataBindEntry);
   depthBindGroupEntries.push_back(objDataBindEntry);
 
+  WGPUBindGroupEntry drawListBindEntry {
+    .nextInChain = nullptr,
+    .binding = 4,
+    .buffer = m_drawListBuffer,
+    .offset = 0,
+    .size = sizeof(u32) * m_maxObjArraySize,
+  };
+  bindGroupEntries.push_back(drawListBindEntry);
+  depthBindGroupEntries.push_back(drawListBindEntry);
+
   WGPUBindGroupEntry lightSpaceBindEntry {
     .nextInChain = nullptr,
     .binding = 2,
@@ -985,9 +1050,11 @@ void WGPURenderBackend::InitPipelines()
   wgpuBindGroupLayoutRelease(bindLayout);
 }
 
-MeshID WGPURenderBackend::UploadMesh(u32 vertCount, Vertex* vertices, u32 indexCount, u32* indices) {
+MeshID WGPURenderBackend::UploadMesh(u32 vertCount, Vertex* vertices, u32 indexCount, u32* indices, MeshBounds bounds) {
   u32 retInt = m_nextMeshID;
   m_meshStore.emplace(std::pair<u32, WGPUBackendMeshIdx>(retInt, WGPUBackendMeshIdx(m_meshTotalIndices, m_meshTotalVertices, indexCount, vertCount)));
+  m_meshBounds[retInt] = bounds;
+  m_instances.meshSpheres[retInt] = bounds.sphere;
   
   wgpuQueueWriteBuffer(m_wgpuQueue, m_meshVertexBuffer, sizeof(Vertex) * m_meshTotalVertices, vertices, sizeof(Vertex) * vertCount);
   wgpuQueueWriteBuffer(m_wgpuQueue, m_meshIndexBuffer, sizeof(u32) * m_meshTotalIndices, indices, sizeof(u32) * indexCount);
@@ -1041,6 +1108,25 @@ void WGPURenderBackend::DestroyMesh(MeshID meshID) {
 
   // Removes mesh cpu side descriptors
   m_meshStore.erase(meshID);
+  m_meshBounds.erase(meshID);
+  m_instances.meshSpheres.erase(meshID);
+}
+
+MeshBounds WGPURenderBackend::GetMeshBounds(MeshID meshID) {
+  auto search = m_meshBounds.find(meshID);
+  return search != m_meshBounds.end() ? search->second : MeshBounds{};
+}
+
+InstanceID WGPURenderBackend::AddInstance() {
+  return m_instances.Add();
+}
+
+void WGPURenderBackend::UpdateInstance(InstanceID instanceID, MeshRenderInfo& info) {
+  m_instances.Update(instanceID, info);
+}
+
+void WGPURenderBackend::DestroyInstance(InstanceID instanceID) {
+  m_instances.Destroy(instanceID);
 }
 
 void WGPURenderBackend::RenderUpdate(RenderFrameInfo& state) {
@@ -1051,49 +1137,30 @@ void WGPURenderBackend::RenderUpdate(RenderFrameInfo& state) {
   }
 
   // Prepares recieved state for rendering
-
-  // >>> Begins processing frame information to be ran by renderer <<<
-
-  // Inserts mesh instance information into a single objData vector
-  std::map<MeshID, u32> meshCounts;
-  for (MeshRenderInfo meshInstance: state.meshes)
-  {
-      meshCounts[meshInstance.mesh] += 1;
-  }
-
-  u32 totalCount = 0;
-  std::unordered_map<MeshID, u32> offsets;
-  for (std::pair<MeshID,u32> meshType : meshCounts) 
-  {
-    offsets[meshType.first] = totalCount;
-    totalCount += meshType.second;
-  }
-
-  std::vector<ObjectData> objData(totalCount);
-
-  for (MeshRenderInfo meshInstance: state.meshes)
-  {
-      objData[offsets[meshInstance.mesh]++] = {meshInstance.matrix, glm::vec4(meshInstance.rgbColor, 1.0f)};
-  }
+  Transform3D cameraTransform = state.cameraTransform;
+  glm::mat4x4 view = GetViewMatrix(&cameraTransform);
+  f32 aspect = (f32)m_screenWidth / (f32)m_screenHeight;
+  glm::mat4x4 proj = glm::perspective(glm::radians(state.cameraFov), aspect, state.cameraNear, state.cameraFar);
+  CameraData mainCam = {view, proj, cameraTransform.position};
 
   // Gets light transforms for 
-  glm::mat4x4 combinedCam = state.mainCam.proj * state.mainCam.view;
+  glm::mat4x4 combinedCam = proj * view;
   PrepareDynamicShadowedDirLights(combinedCam, state.cameraFov, state.cameraNear, state.cameraFar, state.dirLights);
 
   // >>> Actually begins sending off information to be rendered <<<
 
-  // Sends in the attributes of individual mesh instances
-  wgpuQueueWriteBuffer(m_wgpuQueue, m_instanceDatBuffer, 0, objData.data(), sizeof(ObjectData) * objData.size());
+  // Sends in the instances that changed since the last frame
+  UploadInstances();
 
   // Sets the orientation of the view camera
-  wgpuQueueWriteBuffer(m_wgpuQueue, m_cameraBuffer, 0, &state.mainCam, sizeof(CameraData));
+  wgpuQueueWriteBuffer(m_wgpuQueue, m_cameraBuffer, 0, &mainCam, sizeof(CameraData));
 
   BeginDepthPass(m_depthTexture.m_textureView);
-  DrawObjects(meshCounts);
+  DrawInstances();
   EndPass();
 
   BeginColorPass();
-  DrawObjects(meshCounts);
+  DrawInstances();
   EndPass();
 
   DrawImGui();
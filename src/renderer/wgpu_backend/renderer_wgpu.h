@@ -3,6 +3,7 @@
 #include <webgpu/webgpu.h>
 
 #include "renderer/render_backend.h"
+#include "renderer/render_instances.cpp"
 #include "renderer/wgpu_backend/render_types_wgpu.h"
 
 #include "math/skl_math_consts.h"
@@ -64,6 +65,7 @@ private:
 
     WGPUBuffer m_cameraBuffer{ };
     WGPUBuffer m_instanceDatBuffer{ };
+    WGPUBuffer m_drawListBuffer{ };
     WGPUBuffer m_lightSpacesStoreBuffer{ };
     WGPUBuffer m_dynamicShadowedDirLightBuffer{ };
 
@@ -76,6 +78,12 @@ private:
 
     // The id of the next obj that will be created
     MeshID m_nextMeshID{ 0 }; 
+    std::unordered_map<MeshID, MeshBounds> m_meshBounds{ };
+
+    // Queue writes land in order, so a single set of instance slots is kept
+    InstanceTable m_instances{ };
+    std::vector<u32> m_drawList{ };
+    bool m_instanceOverflowLogged{ false };
 
 
     void printDeviceSpecs();
@@ -123,9 +131,12 @@ private:
     // Draws engine interface for game if allowed
     void DrawImGui();
 
-    // Takes in mesh counts and renders to current command encoder using previously
-    // inserted object data in buffer.
-    void DrawObjects(std::map<u32, u32>& meshCounts);
+    // Writes the instance slots and draw list changed since the last frame
+    void UploadInstances();
+
+    // Draws every instance to the current command encoder, one instanced
+    // draw per mesh, using previously uploaded instance data.
+    void DrawInstances();
 
     // Ends the current pass and present it to the screen
     void EndFrame();
@@ -149,8 +160,17 @@ public:
 
     // Moves mesh to the GPU, 
     // Returns a uint that represents the mesh's ID
-    MeshID UploadMesh(uint32_t vertCount, Vertex* vertices, uint32_t indexCount, uint32_t* indices);
+    MeshID UploadMesh(uint32_t vertCount, Vertex* vertices, uint32_t indexCount, uint32_t* indices, MeshBounds bounds);
 
     // Removes mesh from GPU and render's mesh ID invalid
     void DestroyMesh(MeshID meshID);
+
+    // Gets the bounds the mesh was uploaded with
+    MeshBounds GetMeshBounds(MeshID meshID);
+
+    // Creates, updates and removes render instances, which keep their
+    // slot in the instance buffer for as long as they live
+    InstanceID AddInstance();
+    void UpdateInstance(InstanceID instanceID, MeshRenderInfo& info);
+    void DestroyInstance(InstanceID instanceID);
 };
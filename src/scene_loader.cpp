@@ -6,6 +6,8 @@
 struct FieldInfo
 {
     const char *name;
+    const char *type;
+    size_t offset;
     size_t size;
     void (*loadFunc)(char* dest, toml::node*);
 };
@@ -14,10 +16,47 @@ struct ComponentInfo
 {
     void (*loadFunc)(Scene&, EntityID, toml::table*, int);
     std::vector<FieldInfo> fields;
+    const char *name;
+    size_t size;
+    ComponentStorage storage;
+    // Constructs the component with its default values in place.
+    void (*construct)(void *dest);
+    // Whether any field is a pointer, which scene snapshots cannot hold.
+    bool holdsPointers{false};
 };
 
 std::vector<ComponentInfo> compInfos;
 
+// Names of the assets loaded so far by their ID. IDs are handed out by
+// the platform as assets are loaded, so snapshots store names instead.
+// Scenes updated on other threads may load assets at the same time, so
+// loads are serialized, which also protects the platform's own caches.
+std::unordered_map<MeshID, std::string> meshNames;
+std::unordered_map<TextureID, std::string> textureNames;
+std::mutex assetMutex;
+
+MeshID LoadMesh(std::string name)
+{
+    std::lock_guard<std::mutex> lock(assetMutex);
+    MeshID id = globalPlatformAPI.platformLoadMeshAsset(name);
+    if (id != -1)
+    {
+        meshNames[id] = name;
+    }
+    return id;
+}
+
+TextureID LoadTexture(std::string name)
+{
+    std::lock_guard<std::mutex> lock(assetMutex);
+    TextureID id = globalPlatformAPI.platformLoadTextureAsset(name);
+    if (id != -1)
+    {
+        textureNames[id] = name;
+    }
+    return id;
+}
+
 template <typename T>
 void LoadValue(char* dest, toml::node* data) = delete;
 
@@ -83,10 +122,8 @@ void LoadComponent(Scene &scene, EntityID entity, toml::table* compData, int com
     {
         if (compData->contains(field.name))
         {
-            field.loadFunc(comp, compData->get(field.name));
+            field.loadFunc(comp + field.offset, compData->get(field.name));
         }
-
-        comp += field.size;
     }
 }
 
@@ -109,7 +146,7 @@ void LoadComponent<MeshComponent>(Scene &scene, EntityID entity, toml::table* co
 
     std::string meshPath = meshData->as_string()->get();
 
-    comp->mesh = globalPlatformAPI.platformLoadMeshAsset(meshPath);
+    comp->mesh = LoadMesh(meshPath);
 
     if (compData->contains("texture"))
     {
@@ -122,7 +159,7 @@ void LoadComponent<MeshComponent>(Scene &scene, EntityID entity, toml::table* co
 
         std::string texPath = texData->as_string()->get();
 
-        comp->texture = globalPlatformAPI.platformLoadTextureAsset(texPath);
+        comp->texture = LoadTexture(texPath);
     }
 
     if (compData->contains("color"))
@@ -132,44 +169,185 @@ void LoadComponent<MeshComponent>(Scene &scene, EntityID entity, toml::table* co
 }
 
 template <typename T>
-void AddComponent(Scene &scene, const char *name)
+void AddComponent(const char *name, ComponentStorage storage = ARCHETYPE)
 {
     compName<T> = name;
-    MakeComponentId(name);
-    scene.AddComponentPool(sizeof(T));
-    compInfos.push_back({LoadComponent<T>});
+    cachedComponentId<T> = MakeComponentId(name);
+    compInfos.push_back({LoadComponent<T>, {}, name, sizeof(T), storage,
+                         [](void *dest) { new(dest) T(); }});
+}
+
+// Offset of the next field of the component being registered. Fields
+// are laid out in declaration order, each aligned to its own type.
+local size_t NextFieldOffset(ComponentInfo &compInfo, size_t alignment)
+{
+    size_t end = 0;
+    if (!compInfo.fields.empty())
+    {
+        end = compInfo.fields.back().offset + compInfo.fields.back().size;
+    }
+    return (end + alignment - 1) & ~(alignment - 1);
 }
 
 template <typename T>
-void AddField(const char *name)
+void AddField(const char *name, const char *type)
 {
     ComponentInfo& compInfo = compInfos[numComponents - 1];
-    compInfo.fields.push_back({name, sizeof(T), LoadValue<T>});
+    compInfo.fields.push_back({name, type, NextFieldOffset(compInfo, alignof(T)), sizeof(T), LoadValue<T>});
+    compInfo.holdsPointers |= std::is_pointer_v<T>;
 }
 
 template <typename T>
-void AddLocalField(const char *name)
+void AddLocalField(const char *name, const char *type)
 {
     ComponentInfo& compInfo = compInfos[numComponents - 1];
-    compInfo.fields.push_back({name, sizeof(T)});
+    compInfo.fields.push_back({name, type, NextFieldOffset(compInfo, alignof(T)), sizeof(T)});
+    compInfo.holdsPointers |= std::is_pointer_v<T>;
 }
 
-#define COMP(name) AddComponent<name>(scene, #name);
-#define FIELD(type, name, start) AddField<type>(#name)
-#define LOCAL_FIELD(type, name, start) AddLocalField<type>(#name)
+// Hashes the names, types and placement of a component's fields, so
+// that any change to its declaration changes the hash.
+local u64 HashLayout(ComponentLayout &layout, size_t size)
+{
+    u64 hash = 14695981039346656037ull;
+    auto mix = [&hash](const void *data, size_t length)
+    {
+        for (size_t i = 0; i < length; i++)
+        {
+            hash = (hash ^ ((const u8 *)data)[i]) * 1099511628211ull;
+        }
+    };
+
+    mix(&size, sizeof(size));
+    for (FieldLayout &field : layout.fields)
+    {
+        mix(field.name.data(), field.name.size() + 1);
+        mix(field.type.data(), field.type.size() + 1);
+        mix(&field.offset, sizeof(field.offset));
+        mix(&field.size, sizeof(field.size));
+    }
+    return hash;
+}
+
+// Compares the layout each component is registered with against the
+// layout of the scene's data, which differs after a hot reload that
+// changed components.h. Components that changed are converted in
+// place, field by field by name. Fields that kept their name and type
+// keep their value, and the others start out at their default.
+// Changes that move component IDs can't be migrated, and exit with an
+// error instead of running the scene with mismatched components.
+local void MigrateChangedComponents(Scene &scene)
+{
+    if (compInfos.size() < scene.componentLayouts.size())
+    {
+        printf("Components were removed from components.h (%s), which needs a restart\n",
+               scene.componentLayouts.back().name.c_str());
+        exit(1);
+    }
+
+    for (u32 i = 0; i < compInfos.size(); i++)
+    {
+        ComponentInfo &info = compInfos[i];
+        ComponentLayout layout = {info.name};
+        for (FieldInfo &field : info.fields)
+        {
+            layout.fields.push_back({field.name, field.type, (u32)field.offset, (u32)field.size});
+        }
+        layout.hash = HashLayout(layout, info.size);
+
+        if (i == scene.componentLayouts.size())
+        {
+            scene.componentLayouts.push_back(layout);
+            continue;
+        }
+
+        ComponentLayout &old = scene.componentLayouts[i];
+        bool sameStorage = info.storage == scene.GetStorage(i);
+        if (old.name != layout.name || !sameStorage)
+        {
+            // Component IDs follow the order of components.h, so the
+            // masks of every entity would have to be rewritten. The
+            // scene can't be used with this module.
+            printf("Components were added, removed, reordered or moved between storages "
+                   "in components.h (%s), which needs a restart\n", info.name);
+            exit(1);
+        }
+
+        if (old.hash == layout.hash)
+            continue;
+
+        struct FieldCopy
+        {
+            u32 dest;
+            u32 source;
+            u32 size;
+        };
+        std::vector<FieldCopy> copies;
+        for (FieldLayout &field : layout.fields)
+        {
+            for (FieldLayout &oldField : old.fields)
+            {
+                if (field.name == oldField.name && field.type == oldField.type && field.size == oldField.size)
+                {
+                    copies.push_back({field.offset, oldField.offset, field.size});
+                }
+            }
+        }
+
+        scene.MigrateComponent(i, info.size, [&](void *dest, void *source)
+        {
+            info.construct(dest);
+            for (FieldCopy &copy : copies)
+            {
+                memcpy((u8 *)dest + copy.dest, (u8 *)source + copy.source, copy.size);
+            }
+        });
+        printf("Migrated the %s component to its new layout\n", info.name);
+        old = layout;
+    }
+}
+
+#define COMP(name) AddComponent<name>(#name);
+#define SPARSE_COMP(name) AddComponent<name>(#name, SPARSE_SET);
+#define TAG_COMP(name) AddComponent<name>(#name, TAG);
+#define FIELD(type, name, start) AddField<type>(#name, #type)
+#define LOCAL_FIELD(type, name, start) AddLocalField<type>(#name, #type)
 #define LOCAL_DEF(def)
 
-void RegisterComponents(Scene &scene)
+// Whether this module has bound its component IDs yet.
+global_variable bool componentsRegistered = false;
+
+// Binds the component IDs of this module, and records how to load each
+// component. Runs once per module, before any scene is set up.
+void RegisterComponents()
 {
-    AddComponent<Transform3D>(scene, "Transform3D");
-    AddField<glm::vec3>("position");
-    AddField<glm::vec3>("rotation");
-    AddField<glm::vec3>("scale");
+    if (componentsRegistered)
+        return;
+    componentsRegistered = true;
+
+    AddComponent<Transform3D>("Transform3D");
+    AddField<glm::vec3>("position", "glm::vec3");
+    AddField<glm::vec3>("rotation", "glm::vec3");
+    AddField<glm::vec3>("scale", "glm::vec3");
 
     #include "components.h"
 }
 
+// Gives the scene storage for each registered component. Scenes
+// outlive the game module, so after a hot reload each of them has to
+// be set up again, which only migrates the components that changed.
+void AddComponentTypes(Scene &scene)
+{
+    for (u32 i = (u32)scene.componentSizes.size(); i < compInfos.size(); i++)
+    {
+        scene.AddComponentType(compInfos[i].size, compInfos[i].storage);
+    }
+    MigrateChangedComponents(scene);
+}
+
 #undef COMP
+#undef SPARSE_COMP
+#undef TAG_COMP
 #undef FIELD
 #undef LOCAL_FIELD
 #undef LOCAL_DEF
@@ -199,6 +377,12 @@ void LoadScene(Scene& scene, const char* filename)
                 ComponentInfo& compInfo = compInfos[compIndex];
                 compInfo.loadFunc(scene, id, val.second.as_table(), compIndex);
             }
+
+            // Anything placed in the world gets its world matrix cached
+            if (scene.Get<Transform3D>(id) && !scene.Get<WorldTransform>(id))
+            {
+                scene.Assign<WorldTransform>(id);
+            }
         }
 
     }
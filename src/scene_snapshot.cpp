@@ -0,0 +1,552 @@
+#include <cstdio>
+
+#if !_WIN32 && !EMSCRIPTEN
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/*
+ * SCENE SNAPSHOT
+ */
+
+// A snapshot is a binary image of a scene, laid out as
+//
+// - SnapshotHeader
+// - per component: name length, name, size, storage
+// - the entity table, as raw EntityEntry values
+// - the free entity indices
+// - per archetype: mask, row count, chunk size, then the used chunks
+//   byte for byte
+// - per sparse set component: count, dense entity IDs, component data
+// - the names of the meshes and textures the asset IDs refer to
+//
+// Chunks and pools are copied as they are, so loading is mostly bulk
+// copies. Components are therefore expected to be plain data, and
+// scenes with components holding pointers are refused when saving.
+// Runtime handles in local fields, like light and render instance IDs,
+// are replaced by the assign observers when loading. Asset IDs are
+// handed out by the platform at runtime, and are looked up again by
+// name when loading.
+
+constexpr u32 SNAPSHOT_MAGIC = 0x534C4B53; // "SKLS"
+constexpr u32 SNAPSHOT_VERSION = 1;
+
+struct SnapshotHeader
+{
+    u32 magic;
+    u32 version;
+    u32 maskSize;
+    u32 entryLayoutSize;
+    u32 componentCount;
+    u32 entityCount;
+    u32 freeCount;
+    u32 archetypeCount;
+};
+
+local void WriteBytes(FILE *file, const void *data, size_t size)
+{
+    fwrite(data, 1, size, file);
+}
+
+local void WriteU32(FILE *file, u32 value)
+{
+    WriteBytes(file, &value, sizeof(u32));
+}
+
+local void WriteString(FILE *file, const std::string &string)
+{
+    WriteU32(file, (u32)string.size());
+    WriteBytes(file, string.data(), string.size());
+}
+
+template<typename ID>
+local void WriteAssetNames(FILE *file, std::unordered_map<ID, std::string> &names)
+{
+    WriteU32(file, (u32)names.size());
+    for (auto &[id, name] : names)
+    {
+        WriteBytes(file, &id, sizeof(ID));
+        WriteString(file, name);
+    }
+}
+
+// Writes the whole scene to the given file. Returns false if the file
+// could not be written, or if an entity has a component that holds a
+// pointer.
+bool SaveSceneSnapshot(Scene &scene, const char *filename)
+{
+    // Nothing would recreate what such pointers point to after a load
+    for (u32 i = 0; i < compInfos.size() && i < scene.componentSizes.size(); i++)
+    {
+        if (compInfos[i].holdsPointers && scene.AnyEntityMatches(ComponentMask().set(i)))
+        {
+            printf("Unable to save a scene snapshot, the %s component holds pointers\n", compInfos[i].name);
+            return false;
+        }
+    }
+
+    FILE *file = fopen(filename, "wb");
+    if (!file)
+    {
+        printf("Unable to open %s for writing a scene snapshot\n", filename);
+        return false;
+    }
+
+    SnapshotHeader header = {
+            .magic = SNAPSHOT_MAGIC,
+            .version = SNAPSHOT_VERSION,
+            .maskSize = sizeof(ComponentMask),
+            .entryLayoutSize = sizeof(Scene::EntityEntry),
+            .componentCount = (u32)scene.componentSizes.size(),
+            .entityCount = (u32)scene.entities.size(),
+            .freeCount = (u32)scene.freeIndices.size(),
+            .archetypeCount = (u32)scene.archetypes.size()
+    };
+    WriteBytes(file, &header, sizeof(header));
+
+    std::vector<std::string> names(scene.componentSizes.size());
+    for (auto &[name, id] : stringToId)
+    {
+        if (id < names.size())
+        {
+            names[id] = name;
+        }
+    }
+    for (u32 i = 0; i < scene.componentSizes.size(); i++)
+    {
+        WriteString(file, names[i]);
+        WriteU32(file, (u32)scene.componentSizes[i]);
+        WriteU32(file, scene.GetStorage(i));
+    }
+
+    WriteBytes(file, scene.entities.data(), scene.entities.size() * sizeof(Scene::EntityEntry));
+    WriteBytes(file, scene.freeIndices.data(), scene.freeIndices.size() * sizeof(u32));
+
+    for (Archetype *archetype : scene.archetypes)
+    {
+        WriteBytes(file, &archetype->mask, sizeof(ComponentMask));
+        WriteU32(file, archetype->count);
+        WriteU32(file, archetype->chunkBytes);
+        for (u32 chunk = 0; chunk * archetype->chunkCapacity < archetype->count; chunk++)
+        {
+            WriteBytes(file, archetype->chunks[chunk], archetype->chunkBytes);
+        }
+    }
+
+    for (ComponentPool *pool : scene.componentPools)
+    {
+        if (pool)
+        {
+            WriteU32(file, pool->count);
+            WriteBytes(file, pool->dense, pool->count * sizeof(EntityID));
+            WriteBytes(file, pool->pData, pool->count * pool->elementSize);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(assetMutex);
+        WriteAssetNames(file, meshNames);
+        WriteAssetNames(file, textureNames);
+    }
+
+    bool written = !ferror(file);
+    fclose(file);
+    if (!written)
+    {
+        printf("Unable to write the scene snapshot %s\n", filename);
+    }
+    return written;
+}
+
+// Walks the bytes of a snapshot. Reading past the end marks the reader
+// as failed, and hands out zeroes from then on.
+struct SnapshotReader
+{
+    u8 *at;
+    u8 *end;
+    bool failed{false};
+
+    // Returns the next size bytes, or null if there are not enough.
+    u8 *Take(size_t size)
+    {
+        if (failed || (size_t)(end - at) < size)
+        {
+            failed = true;
+            return nullptr;
+        }
+        u8 *result = at;
+        at += size;
+        return result;
+    }
+
+    void Read(void *dest, size_t size)
+    {
+        if (u8 *source = Take(size))
+        {
+            memcpy(dest, source, size);
+        }
+        else
+        {
+            memset(dest, 0, size);
+        }
+    }
+
+    u32 ReadU32()
+    {
+        u32 result;
+        Read(&result, sizeof(u32));
+        return result;
+    }
+
+    std::string ReadString()
+    {
+        u32 length = ReadU32();
+        u8 *chars = Take(length);
+        return chars ? std::string((char *)chars, length) : std::string();
+    }
+};
+
+// The contents of a snapshot file. Files are mapped into memory where
+// the platform allows it, and read in one go elsewhere.
+struct SnapshotFile
+{
+    u8 *data{nullptr};
+    size_t size{0};
+    std::vector<u8> buffer;
+};
+
+local bool OpenSnapshotFile(SnapshotFile &snapshot, const char *filename)
+{
+#if _WIN32 || EMSCRIPTEN
+    FILE *file = fopen(filename, "rb");
+    if (!file)
+    {
+        return false;
+    }
+    fseek(file, 0, SEEK_END);
+    snapshot.buffer.resize(ftell(file));
+    fseek(file, 0, SEEK_SET);
+    size_t read = fread(snapshot.buffer.data(), 1, snapshot.buffer.size(), file);
+    fclose(file);
+    snapshot.data = snapshot.buffer.data();
+    snapshot.size = read;
+    return read == snapshot.buffer.size();
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+    void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+    {
+        return false;
+    }
+    snapshot.data = (u8 *)mapped;
+    snapshot.size = info.st_size;
+    return true;
+#endif
+}
+
+local void CloseSnapshotFile(SnapshotFile &snapshot)
+{
+#if !_WIN32 && !EMSCRIPTEN
+    if (snapshot.data)
+    {
+        munmap(snapshot.data, snapshot.size);
+    }
+#endif
+    snapshot.data = nullptr;
+}
+
+template<typename ID>
+local void SkimAssetNames(SnapshotReader &reader)
+{
+    u32 count = reader.ReadU32();
+    for (u32 i = 0; i < count && !reader.failed; i++)
+    {
+        reader.Take(sizeof(ID));
+        reader.ReadString();
+    }
+}
+
+// Walks the sections after the component table without loading
+// anything, to find out whether the rest of the snapshot is complete
+// and fits the scene's archetype layouts.
+local bool SkimSnapshot(SnapshotReader reader, SnapshotHeader &header, Scene &scene)
+{
+    reader.Take(header.entityCount * sizeof(Scene::EntityEntry));
+    reader.Take(header.freeCount * sizeof(u32));
+    for (u32 i = 0; i < header.archetypeCount && !reader.failed; i++)
+    {
+        ComponentMask mask;
+        reader.Read(&mask, sizeof(ComponentMask));
+        u32 count = reader.ReadU32();
+        u32 chunkBytes = reader.ReadU32();
+
+        Archetype layout(mask, scene.componentSizes);
+        if (chunkBytes != layout.chunkBytes)
+        {
+            return false;
+        }
+        u32 chunkCount = (count + layout.chunkCapacity - 1) / layout.chunkCapacity;
+        reader.Take((size_t)chunkCount * chunkBytes);
+    }
+    for (ComponentPool *pool : scene.componentPools)
+    {
+        if (pool)
+        {
+            u32 count = reader.ReadU32();
+            reader.Take(count * (sizeof(EntityID) + pool->elementSize));
+        }
+    }
+    SkimAssetNames<MeshID>(reader);
+    SkimAssetNames<TextureID>(reader);
+    return !reader.failed;
+}
+
+template<typename ID>
+local std::unordered_map<ID, std::string> ReadAssetNames(SnapshotReader &reader)
+{
+    std::unordered_map<ID, std::string> names;
+    u32 count = reader.ReadU32();
+    for (u32 i = 0; i < count && !reader.failed; i++)
+    {
+        ID id;
+        reader.Read(&id, sizeof(ID));
+        names[id] = reader.ReadString();
+    }
+    return names;
+}
+
+// Loads a snapshot written by SaveSceneSnapshot into a scene without
+// any entities, that has the same components registered. Returns false
+// and leaves the scene as it was if the file is missing, or does not
+// fit the scene.
+bool LoadSceneSnapshot(Scene &scene, const char *filename)
+{
+    if (!scene.entities.empty())
+    {
+        printf("Scene snapshots can only be loaded into an empty scene\n");
+        return false;
+    }
+
+    SnapshotFile file;
+    if (!OpenSnapshotFile(file, filename))
+    {
+        printf("Unable to open the scene snapshot %s\n", filename);
+        return false;
+    }
+
+    SnapshotReader reader = {file.data, file.data + file.size};
+    SnapshotHeader header;
+    reader.Read(&header, sizeof(header));
+
+    // Validate everything before touching the scene
+    bool fits = header.magic == SNAPSHOT_MAGIC && header.version == SNAPSHOT_VERSION &&
+            header.maskSize == sizeof(ComponentMask) &&
+            header.entryLayoutSize == sizeof(Scene::EntityEntry) &&
+            header.componentCount == scene.componentSizes.size();
+    for (u32 i = 0; fits && i < header.componentCount; i++)
+    {
+        std::string name = reader.ReadString();
+        u32 size = reader.ReadU32();
+        u32 storage = reader.ReadU32();
+        auto search = stringToId.find(name);
+        fits = !reader.failed && search != stringToId.end() && search->second == i &&
+                size == scene.componentSizes[i] &&
+                storage == scene.GetStorage(i);
+    }
+    if (!fits)
+    {
+        printf("The scene snapshot %s does not match the registered components\n", filename);
+        CloseSnapshotFile(file);
+        return false;
+    }
+    if (!SkimSnapshot(reader, header, scene))
+    {
+        printf("The scene snapshot %s is truncated or corrupt\n", filename);
+        CloseSnapshotFile(file);
+        return false;
+    }
+
+    scene.entities.resize(header.entityCount);
+    reader.Read(scene.entities.data(), header.entityCount * sizeof(Scene::EntityEntry));
+    scene.freeIndices.resize(header.freeCount);
+    reader.Read(scene.freeIndices.data(), header.freeCount * sizeof(u32));
+
+    // Archetypes get their index in this scene, which the entity table
+    // is then pointed at.
+    std::vector<u32> archetypeMap(header.archetypeCount, INVALID_ARCHETYPE);
+    for (u32 i = 0; i < header.archetypeCount; i++)
+    {
+        ComponentMask mask;
+        reader.Read(&mask, sizeof(ComponentMask));
+        u32 count = reader.ReadU32();
+        u32 chunkBytes = reader.ReadU32();
+
+        archetypeMap[i] = scene.GetArchetype(mask);
+        Archetype *archetype = scene.archetypes[archetypeMap[i]];
+        archetype->count = count;
+        for (u32 chunk = 0; chunk * archetype->chunkCapacity < count; chunk++)
+        {
+            if (chunk == archetype->chunks.size())
+            {
+                archetype->chunks.push_back(new u8[archetype->chunkBytes]);
+            }
+            reader.Read(archetype->chunks[chunk], chunkBytes);
+        }
+    }
+
+    for (Scene::EntityEntry &entry : scene.entities)
+    {
+        if (entry.archetype != INVALID_ARCHETYPE)
+        {
+            entry.archetype = entry.archetype < archetypeMap.size() ? archetypeMap[entry.archetype] : INVALID_ARCHETYPE;
+        }
+    }
+
+    for (ComponentPool *pool : scene.componentPools)
+    {
+        if (!pool)
+            continue;
+
+        u32 count = reader.ReadU32();
+        EntityID *dense = (EntityID *)reader.Take(count * sizeof(EntityID));
+        u8 *data = reader.Take(count * pool->elementSize);
+
+        // Adding the entities in order gives them the same slots, so
+        // the data can be copied over in one go.
+        for (u32 i = 0; i < count; i++)
+        {
+            EntityID id;
+            memcpy(&id, dense + i, sizeof(EntityID));
+            pool->Add(id);
+        }
+        memcpy(pool->pData, data, count * pool->elementSize);
+    }
+
+    std::unordered_map<MeshID, std::string> savedMeshNames = ReadAssetNames<MeshID>(reader);
+    std::unordered_map<TextureID, std::string> savedTextureNames = ReadAssetNames<TextureID>(reader);
+    CloseSnapshotFile(file);
+
+    // Asset IDs differ from run to run, so they are looked up again,
+    // once per asset
+    std::unordered_map<MeshID, MeshID> meshMap;
+    for (auto &[id, name] : savedMeshNames)
+    {
+        meshMap[id] = LoadMesh(name);
+    }
+    std::unordered_map<TextureID, TextureID> textureMap;
+    for (auto &[id, name] : savedTextureNames)
+    {
+        textureMap[id] = LoadTexture(name);
+    }
+    SceneView<MeshComponent>(scene).Each([&](EntityID ent, MeshComponent &m)
+    {
+        if (auto search = meshMap.find(m.mesh); search != meshMap.end())
+        {
+            m.mesh = search->second;
+        }
+        if (auto search = textureMap.find(m.texture); search != textureMap.end())
+        {
+            m.texture = search->second;
+        }
+    });
+
+    // Everything loaded counts as assigned now, both for the change
+    // ticks and the observers.
+    for (Archetype *archetype : scene.archetypes)
+    {
+        for (u32 chunk = 0; chunk * archetype->chunkCapacity < archetype->count; chunk++)
+        {
+            u32 count = archetype->ChunkCount(chunk);
+            for (u32 componentId : archetype->componentIds)
+            {
+                u32 *ticks = archetype->GetTicks(chunk, componentId);
+                std::fill(ticks, ticks + count, scene.changeTick);
+            }
+        }
+    }
+    for (ComponentPool *pool : scene.componentPools)
+    {
+        if (pool)
+        {
+            std::fill(pool->ticks, pool->ticks + pool->count, scene.changeTick);
+        }
+    }
+    for (Scene::EntityEntry &entry : scene.entities)
+    {
+        if (entry.archetype != INVALID_ARCHETYPE)
+        {
+            scene.NotifyAssign(entry.id, entry.mask & scene.observedMask);
+        }
+    }
+
+    return true;
+}
+
+// Whether the saved fields of a component match. Local fields have no
+// load function, and hold runtime state that loading recreates.
+local bool SavedFieldsMatch(ComponentInfo &info, u8 *a, u8 *b)
+{
+    for (FieldInfo &field : info.fields)
+    {
+        if (field.loadFunc && memcmp(a + field.offset, b + field.offset, field.size) != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Saves the scene to the given file, loads it back into a new scene,
+// and compares the two. Returns whether every entity came back with
+// the same ID, components and saved fields. The file is removed after.
+bool CheckSceneSnapshot(Scene &scene, const char *filename)
+{
+    if (!SaveSceneSnapshot(scene, filename))
+    {
+        return false;
+    }
+
+    Scene loaded;
+    AddComponentTypes(loaded);
+    bool matches = LoadSceneSnapshot(loaded, filename) &&
+            loaded.entities.size() == scene.entities.size() &&
+            loaded.freeIndices == scene.freeIndices;
+
+    for (u32 i = 0; matches && i < scene.entities.size(); i++)
+    {
+        Scene::EntityEntry &entry = scene.entities[i];
+        Scene::EntityEntry &loadedEntry = loaded.entities[i];
+        matches = loadedEntry.id == entry.id && loadedEntry.mask == entry.mask;
+        if (!matches || !scene.IsAlive(entry.id))
+            continue;
+
+        for (u32 componentId = 0; matches && componentId < compInfos.size(); componentId++)
+        {
+            if (entry.mask.test(componentId) && !scene.tagMask.test(componentId))
+            {
+                matches = SavedFieldsMatch(compInfos[componentId],
+                                           (u8 *)scene.GetComponent(entry.id, componentId),
+                                           (u8 *)loaded.GetComponent(entry.id, componentId));
+            }
+        }
+    }
+
+    if (!matches)
+    {
+        printf("The scene snapshot %s did not load back into the same scene\n", filename);
+    }
+    remove(filename);
+    return matches;
+}
@@ -27,9 +27,74 @@ std::vector<glm::vec4> getFrustumCorners(const glm::mat4& proj, const glm::mat4&
 
 class RenderSystem : public System
 {
+public:
+    RenderSystem()
+    {
+        Access<CameraComponent, Transform3D>();
+        Access<DirLight, Transform3D>();
+        Access<SpotLight, Transform3D>();
+        Access<PointLight, Transform3D>();
+        Access<MeshComponent, WorldTransform>().Writes<MeshComponent>();
+        runOnMainThread = true;
+    }
+
+    // Lights hold on to their renderer resources for as long as the
+    // light component exists.
+    void OnStart(Scene *scene)
+    {
+        scene->OnAssign<DirLight>([](EntityID ent, DirLight &l) { l.lightID = AddDirLight(); });
+        scene->OnAssign<SpotLight>([](EntityID ent, SpotLight &l) { l.lightID = AddSpotLight(); });
+        scene->OnAssign<PointLight>([](EntityID ent, PointLight &l) { l.lightID = AddPointLight(); });
+        scene->OnRemove<DirLight>([](EntityID ent, DirLight &l) { DestroyDirLight(l.lightID); });
+        scene->OnRemove<SpotLight>([](EntityID ent, SpotLight &l) { DestroySpotLight(l.lightID); });
+        scene->OnRemove<PointLight>([](EntityID ent, PointLight &l) { DestroyPointLight(l.lightID); });
+
+        // The lights loaded with the scene were assigned before the
+        // observers existed
+        SceneView<DirLight>(*scene).Each([](EntityID ent, DirLight &l) { l.lightID = AddDirLight(); });
+        SceneView<SpotLight>(*scene).Each([](EntityID ent, SpotLight &l) { l.lightID = AddSpotLight(); });
+        SceneView<PointLight>(*scene).Each([](EntityID ent, PointLight &l) { l.lightID = AddPointLight(); });
+
+        // Meshes get their render instance from OnUpdate, the first
+        // time they are seen. Assigned components may be copies, so
+        // they start out without one.
+        scene->OnAssign<MeshComponent>([](EntityID ent, MeshComponent &m) { m.instance = -1; });
+        scene->OnRemove<MeshComponent>([](EntityID ent, MeshComponent &m) { DropInstance(m); });
+        auto dropInstance = [scene](EntityID ent, auto &component)
+        {
+            if (MeshComponent *m = scene->Get<MeshComponent>(ent))
+            {
+                DropInstance(*m);
+            }
+        };
+        scene->OnRemove<WorldTransform>(dropInstance);
+        scene->OnAssign<Hidden>(dropInstance);
+        // Tags have no change ticks, so showing the mesh again marks it
+        // instead.
+        scene->OnRemove<Hidden>([scene](EntityID ent, auto &hidden)
+        {
+            scene->MarkChanged<MeshComponent>(ent);
+        });
+    }
+
     void OnUpdate(Scene *scene, GameInput *input, f32 deltaTime)
     {
         NAMED_TIMED_BLOCK(RenderSystem);
+        u32 tick = scene->changeTick;
+
+        // The renderer keeps every mesh's data between frames, so only
+        // the meshes that changed or moved since last frame are sent.
+        SceneView<MeshComponent, WorldTransform> meshView(*scene, QueryFilter().Without<Hidden>());
+        meshView.EachChangedSince(lastTick, [&](EntityID ent, MeshComponent &m, WorldTransform &w)
+        {
+            if (m.instance == -1)
+            {
+                m.instance = AddInstance();
+            }
+            MeshRenderInfo info = {w.matrix, m.color, m.mesh, m.texture};
+            UpdateInstance(m.instance, info);
+        });
+        lastTick = tick;
 
         // Get the main camera view
         SceneView<CameraComponent, Transform3D> cameraView = SceneView<CameraComponent, Transform3D>(*scene);
@@ -43,62 +108,27 @@ class RenderSystem : public System
         Transform3D *cameraTransform = scene->Get<Transform3D>(cameraEnt);
 
         std::vector<DirLightRenderInfo> dirLights;
-        for (EntityID ent: SceneView<DirLight, Transform3D>(*scene))
+        SceneView<DirLight, Transform3D>(*scene).Each([&](EntityID ent, DirLight &l, Transform3D &lTransform)
         {
-            DirLight *l = scene->Get<DirLight>(ent);
-            if (l->lightID == -1)
-            {
-                l->lightID = AddDirLight();
-            }
-
-            Transform3D *lTransform = scene->Get<Transform3D>(ent);
-
-            dirLights.push_back({l->lightID, *lTransform, l->diffuse, l->specular});
-        }
+            dirLights.push_back({l.lightID, lTransform, l.diffuse, l.specular});
+        });
 
         std::vector<SpotLightRenderInfo> spotLights;
-        for (EntityID ent: SceneView<SpotLight, Transform3D>(*scene))
+        SceneView<SpotLight, Transform3D>(*scene).Each([&](EntityID ent, SpotLight &l, Transform3D &lTransform)
         {
-            SpotLight *l = scene->Get<SpotLight>(ent);
-            if (l->lightID == -1)
-            {
-                l->lightID = AddSpotLight();
-            }
-
-            Transform3D *lTransform = scene->Get<Transform3D>(ent);
-
-            spotLights.push_back({l->lightID, *lTransform, l->diffuse, l->specular,
-                                  l->innerCone, l->outerCone, l->range, true});
-        }
+            spotLights.push_back({l.lightID, lTransform, l.diffuse, l.specular,
+                                  l.innerCone, l.outerCone, l.range, true});
+        });
 
         std::vector<PointLightRenderInfo> pointLights;
-        for (EntityID ent: SceneView<PointLight, Transform3D>(*scene))
+        SceneView<PointLight, Transform3D>(*scene).Each([&](EntityID ent, PointLight &l, Transform3D &lTransform)
         {
-            PointLight *l = scene->Get<PointLight>(ent);
-            if (l->lightID == -1)
-            {
-                l->lightID = AddPointLight();
-            }
-
-            Transform3D *lTransform = scene->Get<Transform3D>(ent);
-
-            pointLights.push_back({l->lightID, *lTransform, l->diffuse, l->specular,
-                                   l->constant, l->linear, l->quadratic, l->maxRange, true});
-        }
-
-        std::vector<MeshRenderInfo> meshInstances;
-        for (EntityID ent: SceneView<MeshComponent, Transform3D>(*scene))
-        {
-            Transform3D *t = scene->Get<Transform3D>(ent);
-            glm::mat4 model = GetTransformMatrix(t);
-            MeshComponent *m = scene->Get<MeshComponent>(ent);
-            m->dirty = false;
-            meshInstances.push_back({model, m->color, m->mesh, m->texture});
-        }
+            pointLights.push_back({l.lightID, lTransform, l.diffuse, l.specular,
+                                   l.constant, l.linear, l.quadratic, l.maxRange, true});
+        });
 
         RenderFrameInfo sendState{
                 .cameraTransform = *cameraTransform,
-                .meshes = meshInstances,
                 .dirLights = dirLights,
                 .spotLights = spotLights,
                 .pointLights = pointLights,
@@ -109,6 +139,20 @@ class RenderSystem : public System
 
         RenderUpdate(sendState);
     }
+
+private:
+    // Changes at or after this tick have not been sent yet.
+    u32 lastTick{0};
+
+    // Stops drawing the mesh until OnUpdate sees it again.
+    static void DropInstance(MeshComponent &m)
+    {
+        if (m.instance != -1)
+        {
+            DestroyInstance(m.instance);
+            m.instance = -1;
+        }
+    }
 };
 
 // TODO(marvin): Figure out a better place to put this, for it is not
@@ -168,6 +212,9 @@ public:
     {
         physicsSystem = ps;
         allocator = new JPH::TempAllocatorImpl(1024*1024*16);
+
+        Access<PlayerCharacter, Transform3D>().Writes<Transform3D>();
+        Access<CameraComponent, Transform3D>();
     }
 
     void OnStart(Scene *scene)
@@ -211,46 +258,166 @@ public:
         // Update player and camera transforms from character virtual's position
         JPH::Vec3 cp = cv->GetPosition();
         pt->position = glm::vec3(cp.GetZ(), -cp.GetX(), cp.GetY());
+        scene->MarkChanged<Transform3D>(playerEnt);
 #if 0
         ct->position = glm::vec3(cp.GetZ(), -cp.GetX(), cp.GetY());
 #endif
     }
 };
 
+// Keeps the WorldTransform of entities up to date. Roots take their
+// Transform3D as is, and children are composed with the world matrix
+// of their parent, one level of depth at a time so that parents are
+// always done before their children. Only entities whose Transform3D
+// changed, or whose parent's world matrix was just recomputed, are
+// touched.
+class TransformSystem : public System
+{
+public:
+    TransformSystem()
+    {
+        Access<Transform3D, WorldTransform>().Writes<WorldTransform>();
+        Access<Parent, Transform3D, WorldTransform>().Writes<Parent, WorldTransform>();
+    }
+
+    void OnStart(Scene *scene)
+    {
+        // Gaining a world transform or changing parents needs the
+        // matrix recomputed just like moving does.
+        auto markMoved = [scene](EntityID ent, auto &component)
+        {
+            scene->MarkChanged<Transform3D>(ent);
+        };
+        scene->OnAssign<WorldTransform>(markMoved);
+        scene->OnAssign<Parent>(markMoved);
+        scene->OnRemove<Parent>(markMoved);
+    }
+
+    void OnUpdate(Scene *scene, GameInput *input, f32 deltaTime)
+    {
+        NAMED_TIMED_BLOCK(TransformSystem);
+        u32 tick = scene->changeTick;
+        u32 transformId = GetComponentId<Transform3D>();
+        u32 worldId = GetComponentId<WorldTransform>();
+
+        // Only the roots' own transforms are watched, as marking their
+        // world transforms changed must not bring them back next frame.
+        QueryFilter roots = QueryFilter().With<WorldTransform>().Without<Parent>();
+        SceneView<Transform3D>(*scene, roots).EachChangedSince(lastTick, [&](EntityID ent, Transform3D &t)
+        {
+            scene->Get<WorldTransform>(ent)->matrix = GetTransformMatrix(&t);
+            scene->MarkChanged<WorldTransform>(ent);
+        });
+
+        // Sort the children into levels by their depth
+        for (std::vector<EntityID> &level : levels)
+        {
+            level.clear();
+        }
+        SceneView<Parent, Transform3D, WorldTransform>(*scene).Each([&](EntityID ent, Parent &p, Transform3D &t, WorldTransform &w)
+        {
+            if (p.depth >= levels.size())
+            {
+                levels.resize(p.depth + 1);
+            }
+            levels[p.depth].push_back(ent);
+        });
+
+        for (u32 depth = 1; depth < levels.size(); depth++)
+        {
+            // Entities whose parent moved to another depth move along
+            // with it, possibly into a later level.
+            dirty.clear();
+            for (u32 i = 0; i < levels[depth].size(); i++)
+            {
+                EntityID ent = levels[depth][i];
+                Parent *p = scene->Get<Parent>(ent);
+                bool parentAlive = scene->IsAlive(p->entity);
+                Parent *grandparent = parentAlive ? scene->Get<Parent>(p->entity) : nullptr;
+                u32 actualDepth = grandparent ? grandparent->depth + 1 : 1;
+                if (actualDepth != p->depth)
+                {
+                    p->depth = actualDepth;
+                    if (actualDepth > depth)
+                    {
+                        if (actualDepth >= levels.size())
+                        {
+                            levels.resize(actualDepth + 1);
+                        }
+                        levels[actualDepth].push_back(ent);
+                        continue;
+                    }
+                }
+
+                bool parentMoved = parentAlive && scene->Get<WorldTransform>(p->entity) &&
+                        *scene->GetTick(p->entity, worldId) == tick;
+                if (parentMoved || *scene->GetTick(ent, transformId) >= lastTick)
+                {
+                    dirty.push_back(ent);
+                }
+            }
+
+            // The entities of a level only read the level above
+            ParallelFor((u32)dirty.size(), 256, [&](u32 i)
+            {
+                EntityID ent = dirty[i];
+                EntityID parent = scene->Get<Parent>(ent)->entity;
+                WorldTransform *parentWorld = scene->IsAlive(parent) ? scene->Get<WorldTransform>(parent) : nullptr;
+                glm::mat4 localMatrix = GetTransformMatrix(scene->Get<Transform3D>(ent));
+                scene->Get<WorldTransform>(ent)->matrix = parentWorld ? parentWorld->matrix * localMatrix : localMatrix;
+                scene->MarkChanged<WorldTransform>(ent);
+            });
+        }
+
+        lastTick = tick;
+    }
+
+private:
+    // Changes at or after this tick have not been seen yet.
+    u32 lastTick{0};
+    std::vector<std::vector<EntityID>> levels;
+    std::vector<EntityID> dirty;
+};
+
 class MovementSystem : public System
 {
+public:
+    MovementSystem()
+    {
+        Access<FlyingMovement, Transform3D>().Writes<Transform3D>();
+    }
+
     void OnUpdate(Scene *scene, GameInput *input, f32 deltaTime)
     {
         NAMED_TIMED_BLOCK(MovementSystem);
-        for (EntityID ent: SceneView<FlyingMovement, Transform3D>(*scene))
+        SceneView<FlyingMovement, Transform3D>(*scene).Each([&](EntityID ent, FlyingMovement &f, Transform3D &t)
         {
-            FlyingMovement *f = scene->Get<FlyingMovement>(ent);
-            Transform3D *t = scene->Get<Transform3D>(ent);
-
-            t->rotation.z += input->mouseDeltaX * f->turnSpeed;
-            t->rotation.y += input->mouseDeltaY * f->turnSpeed;
-            t->rotation.y = std::min(std::max(t->rotation.y, -90.0f), 90.0f);
+            t.rotation.z += input->mouseDeltaX * f.turnSpeed;
+            t.rotation.y += input->mouseDeltaY * f.turnSpeed;
+            t.rotation.y = std::min(std::max(t.rotation.y, -90.0f), 90.0f);
 
             if (input->keysDown.contains("W"))
             {
-                t->position += GetForwardVector(t) * f->moveSpeed * deltaTime;
+                t.position += GetForwardVector(&t) * f.moveSpeed * deltaTime;
             }
 
             if (input->keysDown.contains("S"))
             {
-                t->position -= GetForwardVector(t) * f->moveSpeed * deltaTime;
+                t.position -= GetForwardVector(&t) * f.moveSpeed * deltaTime;
             }
 
             if (input->keysDown.contains("D"))
             {
-                t->position += GetRightVector(t) * f->moveSpeed * deltaTime;
+                t.position += GetRightVector(&t) * f.moveSpeed * deltaTime;
             }
 
             if (input->keysDown.contains("A"))
             {
-                t->position -= GetRightVector(t) * f->moveSpeed * deltaTime;
+                t.position -= GetRightVector(&t) * f.moveSpeed * deltaTime;
             }
-        }
+
+            scene->MarkChanged<Transform3D>(ent);
+        });
     }
 };
 
@@ -282,10 +449,21 @@ private:
     f32 rate = 0.5f;   // Steps per second
 
     u32 pointLightCount = 0;
+    // Each builder draws from its own generator, so that cities built
+    // in different scenes at once only depend on their seed.
+    std::mt19937 rng;
 public:
-    BuilderSystem(bool slowStep)
+    // Structural changes go through the command buffer, so planes
+    // created in a step are only visited in the next one. Loading
+    // meshes uploads them to the GPU, which has to happen on the main
+    // thread.
+    BuilderSystem(bool slowStep, u32 seed)
     {
         this->slowStep = slowStep;
+        rng.seed(seed);
+
+        Access<Plane, Transform3D>().Writes<Plane, Transform3D>();
+        runOnMainThread = true;
     }
 
     void OnUpdate(Scene *scene, GameInput *input, f32 deltaTime)
@@ -317,185 +495,197 @@ public:
     void Step(Scene *scene)
     {
         // Plane Rules
-        for (EntityID ent: SceneView<Plane, Transform3D>(*scene))
+        SceneView<Plane, Transform3D>(*scene).Each([&](EntityID ent, Plane &plane, Transform3D &t)
         {
-            Transform3D *t = scene->Get<Transform3D>(ent);
-            Plane *plane = scene->Get<Plane>(ent);
+            ApplyPlaneRule(scene, ent, &plane, &t);
+        });
+    }
 
-            if (plane->width <= 16.0f || plane->length <= 16.0f || (plane->width / plane->length) >= 128 || (plane->length / plane->width) >= 128)
+    void ApplyPlaneRule(Scene *scene, EntityID ent, Plane *plane, Transform3D *t)
+    {
+        if (plane->width <= 16.0f || plane->length <= 16.0f || (plane->width / plane->length) >= 128 || (plane->length / plane->width) >= 128)
+        {
+            if (RandInBetween(rng, 0.0f, 1.0f) > 0.975f)
             {
-                if (RandInBetween(0.0f, 1.0f) > 0.975f)
-                {
-                    // Build antenna
-                    f32 antennaHeight = RandInBetween(antennaHeightMin, antennaHeightMax);
-                    BuildPart(scene, ent, t, globalPlatformAPI.platformLoadMeshAsset("cube"), {antennaWidth, antennaWidth, antennaHeight});
-                    t->position.z -= antennaWidth / 2;
+                // Build antenna
+                f32 antennaHeight = RandInBetween(rng, antennaHeightMin, antennaHeightMax);
+                BuildPart(scene, ent, t, LoadMesh("cube"), {antennaWidth, antennaWidth, antennaHeight});
+                t->position.z -= antennaWidth / 2;
 
-                    if (pointLightCount < 64)
-                    {
-                        EntityID pointLight = scene->NewEntity();
-                        Transform3D* pointTransform = scene->Assign<Transform3D>(pointLight);
-                        *pointTransform = *t;
-                        pointTransform->position.z += antennaHeight / 2;
-                        PointLight* pointLightComponent = scene->Assign<PointLight>(pointLight);
-                        f32 red = RandInBetween(0.8, 1.0);
-                        pointLightComponent->diffuse = {red, 0.6, 0.25};
-                        pointLightComponent->specular = {red, 0.6, 0.25};
-                        pointLightComponent->constant = 1;
-                        pointLightComponent->linear = 0.0005;
-                        pointLightComponent->quadratic = 0.00005;
-                        pointLightComponent->maxRange = 1000;
-
-                        pointLightCount++;
-                    }
+                if (pointLightCount < 64)
+                {
+                    EntityID pointLight = commands.NewEntity();
+                    Transform3D pointTransform = *t;
+                    pointTransform.position.z += antennaHeight / 2;
+                    PointLight pointLightComponent;
+                    f32 red = RandInBetween(rng, 0.8, 1.0);
+                    pointLightComponent.diffuse = {red, 0.6, 0.25};
+                    pointLightComponent.specular = {red, 0.6, 0.25};
+                    pointLightComponent.constant = 1;
+                    pointLightComponent.linear = 0.0005;
+                    pointLightComponent.quadratic = 0.00005;
+                    pointLightComponent.maxRange = 1000;
+                    commands.Assign(pointLight, pointTransform);
+                    commands.Assign(pointLight, pointLightComponent);
+
+                    pointLightCount++;
                 }
-
-                scene->Remove<Plane>(ent);
-                continue;
             }
 
-            switch (RandInt(0, 13))
+            commands.Remove<Plane>(ent);
+            return;
+        }
+
+        switch (RandInt(rng, 0, 13))
+        {
+        case 0:
+            {
+                // Rotate
+                f32 shortSide = std::min(plane->width, plane->length);
+                f32 longSide = std::max(plane->width, plane->length);
+
+                f32 maxAngle = atan2(shortSide, longSide) - 0.02f;
+
+                f32 angle = RandInBetween(rng, glm::radians(7.5f), maxAngle);
+
+                f32 costheta = cos(angle);
+                f32 sintheta = sin(angle);
+                f32 denom = ((costheta * costheta) - (sintheta * sintheta));
+                f32 width = ((plane->width * costheta) -
+                             (plane->length * sintheta)) / denom;
+                f32 length = ((plane->length * costheta) -
+                              (plane->width * sintheta)) / denom;
+                plane->width = width;
+                plane->length = length;
+
+                t->rotation.z += glm::degrees(angle);
+                scene->MarkChanged<Plane>(ent);
+                scene->MarkChanged<Transform3D>(ent);
+                break;
+            }
+        case 1:
             {
-            case 0:
+                // Build Trapezoid
+                if (plane->width > 256 || plane->length > 256)
                 {
-                    // Rotate
-                    f32 shortSide = std::min(plane->width, plane->length);
-                    f32 longSide = std::max(plane->width, plane->length);
-
-                    f32 maxAngle = atan2(shortSide, longSide) - 0.02f;
-
-                    f32 angle = RandInBetween(glm::radians(7.5f), maxAngle);
-
-                    f32 costheta = cos(angle);
-                    f32 sintheta = sin(angle);
-                    f32 denom = ((costheta * costheta) - (sintheta * sintheta));
-                    f32 width = ((plane->width * costheta) -
-                                 (plane->length * sintheta)) / denom;
-                    f32 length = ((plane->length * costheta) -
-                                  (plane->width * sintheta)) / denom;
-                    plane->width = width;
-                    plane->length = length;
-
-                    t->rotation.z += glm::degrees(angle);
-                    break;
+                    return;
                 }
-            case 1:
-                {
-                    // Build Trapezoid
-                    if (plane->width > 256 || plane->length > 256)
-                    {
-                        continue;
-                    }
 
-                    f32 trapHeight = RandInBetween(trapHeightMin, trapHeightMax);
-                    BuildPart(scene, ent, t, globalPlatformAPI.platformLoadMeshAsset("trap"), {plane->length, plane->width, trapHeight});
+                f32 trapHeight = RandInBetween(rng, trapHeightMin, trapHeightMax);
+                BuildPart(scene, ent, t, LoadMesh("trap"), {plane->length, plane->width, trapHeight});
 
-                    EntityID newPlane = scene->NewEntity();
-                    Transform3D *newT = scene->Assign<Transform3D>(newPlane);
-                    Plane *p = scene->Assign<Plane>(newPlane);
-                    *newT = *t;
-                    newT->position.z += trapHeight / 2;
-                    p->width = plane->width / 2;
-                    p->length = plane->length / 2;
+                Transform3D newT = *t;
+                newT.position.z += trapHeight / 2;
+                Plane p;
+                p.width = plane->width / 2;
+                p.length = plane->length / 2;
+                EntityID newPlane = commands.NewEntity();
+                commands.Assign(newPlane, newT);
+                commands.Assign(newPlane, p);
 
-                    scene->Remove<Plane>(ent);
-                    break;
-                }
-            case 2:
+                commands.Remove<Plane>(ent);
+                break;
+            }
+        case 2:
+            {
+                // Build Pyramid Roof
+                if (plane->width > 96 || plane->length > 96)
                 {
-                    // Build Pyramid Roof
-                    if (plane->width > 96 || plane->length > 96)
-                    {
-                        continue;
-                    }
-
-                    f32 pyraHeight = RandInBetween(roofHeightMin, roofHeightMax);
-                    BuildPart(scene, ent, t, globalPlatformAPI.platformLoadMeshAsset("pyra"), {plane->length, plane->width, pyraHeight});
-
-                    scene->Remove<Plane>(ent);
-                    break;
+                    return;
                 }
-            case 3:
-                {
-                    // Build Prism Roof
-                    if (plane->width > 96)
-                    {
-                        continue;
-                    }
 
-                    f32 prismHeight = RandInBetween(roofHeightMin, roofHeightMax);
-                    BuildPart(scene, ent, t, globalPlatformAPI.platformLoadMeshAsset("prism"), {plane->length, plane->width, prismHeight});
+                f32 pyraHeight = RandInBetween(rng, roofHeightMin, roofHeightMax);
+                BuildPart(scene, ent, t, LoadMesh("pyra"), {plane->length, plane->width, pyraHeight});
 
-                    scene->Remove<Plane>(ent);
-                    break;
-                }
-            case 4:
-            case 5:
-            case 6:
-            case 7:
+                commands.Remove<Plane>(ent);
+                break;
+            }
+        case 3:
+            {
+                // Build Prism Roof
+                if (plane->width > 96)
                 {
-                    // Build Cuboid
-                    f32 cuboidHeight = RandInBetween(cuboidHeightMin, cuboidHeightMax);
-                    BuildPart(scene, ent, t, globalPlatformAPI.platformLoadMeshAsset("cube"), {plane->length, plane->width, cuboidHeight});
-
-                    EntityID newPlane = scene->NewEntity();
-                    Transform3D *newT = scene->Assign<Transform3D>(newPlane);
-                    Plane *p = scene->Assign<Plane>(newPlane);
-                    *newT = *t;
-                    newT->position.z += cuboidHeight / 2;
-                    *p = *plane;
-
-                    scene->Remove<Plane>(ent);
-                    break;
+                    return;
                 }
-            default:
-                {
-                    // Subdivide
-                    EntityID newPlane = scene->NewEntity();
-                    Transform3D *newT = scene->Assign<Transform3D>(newPlane);
-                    Plane *p = scene->Assign<Plane>(newPlane);
-                    *newT = *t;
-                    *p = *plane;
 
-                    f32 ratio = RandInBetween(0.2f, 0.8f);
+                f32 prismHeight = RandInBetween(rng, roofHeightMin, roofHeightMax);
+                BuildPart(scene, ent, t, LoadMesh("prism"), {plane->length, plane->width, prismHeight});
 
-                    if (RandInBetween(0.0f, plane->width + plane->length) < plane->length)
-                    {
-                        // Split X axis
-                        f32 old = plane->length;
-                        f32 divisible = plane->length - 16.0f;
+                commands.Remove<Plane>(ent);
+                break;
+            }
+        case 4:
+        case 5:
+        case 6:
+        case 7:
+            {
+                // Build Cuboid
+                f32 cuboidHeight = RandInBetween(rng, cuboidHeightMin, cuboidHeightMax);
+                BuildPart(scene, ent, t, LoadMesh("cube"), {plane->length, plane->width, cuboidHeight});
+
+                Transform3D newT = *t;
+                newT.position.z += cuboidHeight / 2;
+                EntityID newPlane = commands.NewEntity();
+                commands.Assign(newPlane, newT);
+                commands.Assign(newPlane, *plane);
+
+                commands.Remove<Plane>(ent);
+                break;
+            }
+        default:
+            {
+                // Subdivide
+                Transform3D newT = *t;
+                Plane p = *plane;
 
-                        plane->length = divisible * ratio;
-                        p->length = divisible * (1.0f - ratio);
+                f32 ratio = RandInBetween(rng, 0.2f, 0.8f);
 
-                        t->position -= GetForwardVector(t) * ((old - plane->length) * 0.5f);
-                        newT->position += GetForwardVector(newT) * ((old - p->length) * 0.5f);
-                    }
-                    else
-                    {
-                        // Split Y axis
-                        f32 old = plane->width;
-                        f32 divisible = plane->width - 16.0f;
+                if (RandInBetween(rng, 0.0f, plane->width + plane->length) < plane->length)
+                {
+                    // Split X axis
+                    f32 old = plane->length;
+                    f32 divisible = plane->length - 16.0f;
 
-                        plane->width = divisible * ratio;
-                        p->width = divisible * (1.0f - ratio);
+                    plane->length = divisible * ratio;
+                    p.length = divisible * (1.0f - ratio);
 
-                        t->position -= GetRightVector(t) * ((old - plane->width) * 0.5f);
-                        newT->position += GetRightVector(newT) * ((old - p->width) * 0.5f);
-                    }
+                    t->position -= GetForwardVector(t) * ((old - plane->length) * 0.5f);
+                    newT.position += GetForwardVector(&newT) * ((old - p.length) * 0.5f);
+                }
+                else
+                {
+                    // Split Y axis
+                    f32 old = plane->width;
+                    f32 divisible = plane->width - 16.0f;
+
+                    plane->width = divisible * ratio;
+                    p.width = divisible * (1.0f - ratio);
+
+                    t->position -= GetRightVector(t) * ((old - plane->width) * 0.5f);
+                    newT.position += GetRightVector(&newT) * ((old - p.width) * 0.5f);
                 }
+                scene->MarkChanged<Plane>(ent);
+                scene->MarkChanged<Transform3D>(ent);
+
+                EntityID newPlane = commands.NewEntity();
+                commands.Assign(newPlane, newT);
+                commands.Assign(newPlane, p);
             }
         }
     }
 
+    // Gives the entity a mesh of the given scale.
     void BuildPart(Scene *scene, EntityID ent, Transform3D *t, uint32_t mesh, glm::vec3 scale)
     {
         t->position.z += scale.z / 2;
         t->scale = scale;
-
-        MeshComponent *m = scene->Assign<MeshComponent>(ent);
-        m->mesh = mesh;
-        f32 shade = RandInBetween(0.25f, 0.75f);
-        m->color = {shade, shade, shade};
+        scene->MarkChanged<Transform3D>(ent);
+
+        MeshComponent m;
+        m.mesh = mesh;
+        f32 shade = RandInBetween(rng, 0.25f, 0.75f);
+        m.color = {shade, shade, shade};
+        commands.Assign(ent, m);
+        commands.Assign(ent, WorldTransform());
     }
 };